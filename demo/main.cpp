@@ -26,7 +26,6 @@
 #include <QFileDialog>
 #include <QDir>
 #include <QHostAddress>
-#include <QUdpSocket>
 #include <QtPlugin>
 #include <QLibrary>
 #include "psimedia.h"
@@ -538,153 +537,6 @@ private slots:
 	}
 };
 
-// handles two udp sockets
-class RtpSocketGroup : public QObject
-{
-	Q_OBJECT
-
-public:
-	QUdpSocket socket[2];
-
-	RtpSocketGroup(QObject *parent = 0) :
-		QObject(parent)
-	{
-		connect(&socket[0], SIGNAL(readyRead()), SLOT(sock_readyRead()));
-		connect(&socket[1], SIGNAL(readyRead()), SLOT(sock_readyRead()));
-		connect(&socket[0], SIGNAL(bytesWritten(qint64)), SLOT(sock_bytesWritten(qint64)));
-		connect(&socket[1], SIGNAL(bytesWritten(qint64)), SLOT(sock_bytesWritten(qint64)));
-	}
-
-	bool bind(int basePort)
-	{
-		if(!socket[0].bind(basePort))
-			return false;
-		if(!socket[1].bind(basePort + 1))
-			return false;
-		return true;
-	}
-
-signals:
-	void readyRead(int offset);
-	void datagramWritten(int offset);
-
-private slots:
-	void sock_readyRead()
-	{
-		QUdpSocket *udp = (QUdpSocket *)sender();
-		if(udp == &socket[0])
-			emit readyRead(0);
-		else
-			emit readyRead(1);
-	}
-
-	void sock_bytesWritten(qint64 bytes)
-	{
-		Q_UNUSED(bytes);
-
-		QUdpSocket *udp = (QUdpSocket *)sender();
-		if(udp == &socket[0])
-			emit datagramWritten(0);
-		else
-			emit datagramWritten(1);
-	}
-};
-
-// bind a channel to a socket group.
-// takes ownership of socket group.
-class RtpBinding : public QObject
-{
-	Q_OBJECT
-
-public:
-	enum Mode
-	{
-		Send,
-		Receive
-	};
-
-	Mode mode;
-	PsiMedia::RtpChannel *channel;
-	RtpSocketGroup *socketGroup;
-	QHostAddress sendAddress;
-	int sendBasePort;
-
-	RtpBinding(Mode _mode, PsiMedia::RtpChannel *_channel, RtpSocketGroup *_socketGroup, QObject *parent = 0) :
-		QObject(parent),
-		mode(_mode),
-		channel(_channel),
-		socketGroup(_socketGroup),
-		sendBasePort(-1)
-	{
-		socketGroup->setParent(this);
-		connect(socketGroup, SIGNAL(readyRead(int)), SLOT(net_ready(int)));
-		connect(socketGroup, SIGNAL(datagramWritten(int)), SLOT(net_written(int)));
-		connect(channel, SIGNAL(readyRead()), SLOT(app_ready()));
-		connect(channel, SIGNAL(packetsWritten(int)), SLOT(app_written(int)));
-	}
-
-private slots:
-	void net_ready(int offset)
-	{
-		// here we handle packets received from the network, that
-		//   we need to give to psimedia
-
-		while(socketGroup->socket[offset].hasPendingDatagrams())
-		{
-			int size = (int)socketGroup->socket[offset].pendingDatagramSize();
-			QByteArray rawValue(size, offset);
-			QHostAddress fromAddr;
-			quint16 fromPort;
-			if(socketGroup->socket[offset].readDatagram(rawValue.data(), size, &fromAddr, &fromPort) == -1)
-				continue;
-
-			// if we are sending RTP, we should not be receiving
-			//   anything on offset 0
-			if(mode == Send && offset == 0)
-				continue;
-
-			PsiMedia::RtpPacket packet(rawValue, offset);
-			channel->write(packet);
-		}
-	}
-
-	void net_written(int offset)
-	{
-		Q_UNUSED(offset);
-		// do nothing
-	}
-
-	void app_ready()
-	{
-		// here we handle packets that psimedia wants to send out,
-		//   that we need to give to the network
-
-		while(channel->packetsAvailable() > 0)
-		{
-			PsiMedia::RtpPacket packet = channel->read();
-			int offset = packet.portOffset();
-			if(offset < 0 || offset > 1)
-				continue;
-
-			// if we are receiving RTP, we should not be sending
-			//   anything on offset 0
-			if(mode == Receive && offset == 0)
-				continue;
-
-			if(sendAddress.isNull() || sendBasePort < BASE_PORT_MIN || sendBasePort > BASE_PORT_MAX)
-				continue;
-
-			socketGroup->socket[offset].writeDatagram(packet.rawValue(), sendAddress, sendBasePort + offset);
-		}
-	}
-
-	void app_written(int count)
-	{
-		Q_UNUSED(count);
-		// do nothing
-	}
-};
-
 class MainWin : public QMainWindow
 {
 	Q_OBJECT
@@ -698,8 +550,8 @@ public:
 	Configuration config;
 	bool transmitAudio, transmitVideo, transmitting;
 	bool receiveAudio, receiveVideo;
-	RtpBinding *sendAudioRtp, *sendVideoRtp;
-	RtpBinding *receiveAudioRtp, *receiveVideoRtp;
+	PsiMedia::RtpTransport *sendAudioRtp, *sendVideoRtp;
+	PsiMedia::RtpTransport *receiveAudioRtp, *receiveVideoRtp;
 	bool recording;
 	QFile *recordFile;
 
@@ -1017,15 +869,36 @@ private slots:
 			}
 		}
 
-		RtpSocketGroup *audioSocketGroup = new RtpSocketGroup;
-		sendAudioRtp = new RtpBinding(RtpBinding::Send, producer.audioRtpChannel(), audioSocketGroup, this);
-		sendAudioRtp->sendAddress = addr;
-		sendAudioRtp->sendBasePort = audioPort;
+		// we send from ports picked by the system
+		QHostAddress any = (addr.protocol() == QAbstractSocket::IPv6Protocol) ? QHostAddress::AnyIPv6 : QHostAddress::Any;
 
-		RtpSocketGroup *videoSocketGroup = new RtpSocketGroup;
-		sendVideoRtp = new RtpBinding(RtpBinding::Send, producer.videoRtpChannel(), videoSocketGroup, this);
-		sendVideoRtp->sendAddress = addr;
-		sendVideoRtp->sendBasePort = videoPort;
+		if(transmitAudio)
+		{
+			sendAudioRtp = new PsiMedia::RtpTransport(producer.audioRtpChannel(), this);
+			sendAudioRtp->setRemote(addr, audioPort);
+			if(!sendAudioRtp->bind(any, 0))
+			{
+				cleanup_send_rtp();
+				QMessageBox::critical(this, tr("Error"), tr(
+					"Unable to bind send audio ports."
+					));
+				return;
+			}
+		}
+
+		if(transmitVideo)
+		{
+			sendVideoRtp = new PsiMedia::RtpTransport(producer.videoRtpChannel(), this);
+			sendVideoRtp->setRemote(addr, videoPort);
+			if(!sendVideoRtp->bind(any, 0))
+			{
+				cleanup_send_rtp();
+				QMessageBox::critical(this, tr("Error"), tr(
+					"Unable to bind send video ports."
+					));
+				return;
+			}
+		}
 
 		setSendFieldsEnabled(false);
 		ui.pb_transmit->setEnabled(false);
@@ -1118,36 +991,26 @@ private slots:
 			receiver.setRemoteVideoPreferences(payloadInfoList);
 		}
 
-		RtpSocketGroup *audioSocketGroup = new RtpSocketGroup(this);
-		RtpSocketGroup *videoSocketGroup = new RtpSocketGroup(this);
-		if(!audioSocketGroup->bind(audioPort))
+		// no remote is set, so what the receiver sends (rtcp) is dropped
+		receiveAudioRtp = new PsiMedia::RtpTransport(receiver.audioRtpChannel(), this);
+		receiveVideoRtp = new PsiMedia::RtpTransport(receiver.videoRtpChannel(), this);
+		if(!receiveAudioRtp->bind(QHostAddress::Any, audioPort))
 		{
-			delete audioSocketGroup;
-			audioSocketGroup = 0;
-			delete videoSocketGroup;
-			videoSocketGroup = 0;
-
+			cleanup_receive_rtp();
 			QMessageBox::critical(this, tr("Error"), tr(
 				"Unable to bind to receive audio ports."
 				));
 			return;
 		}
-		if(!videoSocketGroup->bind(videoPort))
+		if(!receiveVideoRtp->bind(QHostAddress::Any, videoPort))
 		{
-			delete audioSocketGroup;
-			audioSocketGroup = 0;
-			delete videoSocketGroup;
-			videoSocketGroup = 0;
-
+			cleanup_receive_rtp();
 			QMessageBox::critical(this, tr("Error"), tr(
 				"Unable to bind to receive video ports."
 				));
 			return;
 		}
 
-		receiveAudioRtp = new RtpBinding(RtpBinding::Receive, receiver.audioRtpChannel(), audioSocketGroup, this);
-		receiveVideoRtp = new RtpBinding(RtpBinding::Receive, receiver.videoRtpChannel(), videoSocketGroup, this);
-
 		setReceiveFieldsEnabled(false);
 		ui.pb_startReceive->setEnabled(false);
 		ui.pb_stopReceive->setEnabled(true);
@@ -135,6 +135,12 @@ static GstElement *video_codec_to_rtppay_element(const QString &name)
 	else
 		return 0;
 
+	// note: "buffer-list" is deliberately left off.  in list mode each
+	//   packet is a header plus a payload sub-buffer, and apprtpsink would
+	//   have to merge (copy) them into one contiguous packet for the app,
+	//   defeating the zero-copy handoff of single-buffer packets.  batches
+	//   are formed after the payloader instead, by rtppacer or by
+	//   apprtpsink collecting each frame
 	return gst_element_factory_make(ename.toLatin1().data(), NULL);
 }
 
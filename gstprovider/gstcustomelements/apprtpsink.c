@@ -22,9 +22,16 @@
 
 #include "gstboilerplatefixed.h"
 
+// most packets we'll hold back while collecting a frame
+#define APPRTPSINK_MAX_PENDING 64
+
 GST_BOILERPLATE(GstAppRtpSink, gst_apprtpsink, GstBaseSink, GST_TYPE_BASE_SINK);
 
+static void gst_apprtpsink_finalize(GObject *obj);
+static gboolean gst_apprtpsink_event(GstBaseSink *sink, GstEvent *event);
+static gboolean gst_apprtpsink_stop(GstBaseSink *sink);
 static GstFlowReturn gst_apprtpsink_render(GstBaseSink *sink, GstBuffer *buffer);
+static GstFlowReturn gst_apprtpsink_render_list(GstBaseSink *sink, GstBufferList *list);
 
 static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE("sink",
 	GST_PAD_SINK,
@@ -50,9 +57,15 @@ void gst_apprtpsink_base_init(gpointer gclass)
 // class init
 void gst_apprtpsink_class_init(GstAppRtpSinkClass *klass)
 {
+	GObjectClass *gobject_class;
 	GstBaseSinkClass *basesink_class;
+	gobject_class = (GObjectClass *)klass;
 	basesink_class = (GstBaseSinkClass *)klass;
+	gobject_class->finalize = gst_apprtpsink_finalize;
+	basesink_class->event = gst_apprtpsink_event;
+	basesink_class->stop = gst_apprtpsink_stop;
 	basesink_class->render = gst_apprtpsink_render;
+	basesink_class->render_list = gst_apprtpsink_render_list;
 }
 
 // instance init
@@ -62,6 +75,70 @@ void gst_apprtpsink_init(GstAppRtpSink *sink, GstAppRtpSinkClass *gclass)
 
 	sink->appdata = 0;
 	sink->packet_ready = 0;
+	sink->packet_ready_buffer = 0;
+	sink->packets_ready = 0;
+	sink->collect_frames = FALSE;
+	sink->pending = g_ptr_array_sized_new(APPRTPSINK_MAX_PENDING);
+}
+
+static void pending_clear(GstAppRtpSink *self)
+{
+	guint n;
+
+	for(n = 0; n < self->pending->len; ++n)
+		gst_buffer_unref((GstBuffer *)g_ptr_array_index(self->pending, n));
+	g_ptr_array_set_size(self->pending, 0);
+}
+
+// hand over what we've collected, as one batch
+static void pending_flush(GstAppRtpSink *self)
+{
+	if(self->pending->len == 0)
+		return;
+
+	self->packets_ready((GstBuffer **)self->pending->pdata, (int)self->pending->len, self->appdata);
+	pending_clear(self);
+}
+
+static gboolean has_marker(GstBuffer *buf)
+{
+	const guint8 *p = GST_BUFFER_DATA(buf);
+
+	// version 2, marker is the high bit of the second byte
+	return GST_BUFFER_SIZE(buf) >= 2 && (p[0] >> 6) == 2 && (p[1] & 0x80);
+}
+
+// destruct
+void gst_apprtpsink_finalize(GObject *obj)
+{
+	GstAppRtpSink *self = (GstAppRtpSink *)obj;
+
+	pending_clear(self);
+	g_ptr_array_free(self->pending, TRUE);
+
+	G_OBJECT_CLASS(parent_class)->finalize(obj);
+}
+
+gboolean gst_apprtpsink_event(GstBaseSink *sink, GstEvent *event)
+{
+	GstAppRtpSink *self = (GstAppRtpSink *)sink;
+
+	// the stream ended mid-frame, or is being flushed
+	if(GST_EVENT_TYPE(event) == GST_EVENT_EOS)
+	{
+		if(self->packets_ready)
+			pending_flush(self);
+	}
+	else if(GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP)
+		pending_clear(self);
+
+	return TRUE;
+}
+
+gboolean gst_apprtpsink_stop(GstBaseSink *sink)
+{
+	pending_clear((GstAppRtpSink *)sink);
+	return TRUE;
 }
 
 GstFlowReturn gst_apprtpsink_render(GstBaseSink *sink, GstBuffer *buffer)
@@ -71,8 +148,81 @@ GstFlowReturn gst_apprtpsink_render(GstBaseSink *sink, GstBuffer *buffer)
 	// the assumption here is that every buffer is a complete rtp
 	//   packet, ready for sending
 
-	if(self->packet_ready)
+	if(self->packets_ready && self->collect_frames)
+	{
+		g_ptr_array_add(self->pending, gst_buffer_ref(buffer));
+		if(has_marker(buffer) || self->pending->len >= APPRTPSINK_MAX_PENDING)
+			pending_flush(self);
+	}
+	else if(self->packets_ready)
+		self->packets_ready(&buffer, 1, self->appdata);
+	else if(self->packet_ready_buffer)
+		self->packet_ready_buffer(buffer, self->appdata);
+	else if(self->packet_ready)
 		self->packet_ready(GST_BUFFER_DATA(buffer), GST_BUFFER_SIZE(buffer), self->appdata);
 
 	return GST_FLOW_OK;
 }
+
+GstFlowReturn gst_apprtpsink_render_list(GstBaseSink *sink, GstBufferList *list)
+{
+	GstAppRtpSink *self = (GstAppRtpSink *)sink;
+	GstBufferListIterator *it;
+	GstBuffer **bufs;
+	GstBuffer *buf;
+	guint count, at, n;
+
+	// without a batch callback, let basesink hand us one packet at a time
+	if(!self->packets_ready)
+	{
+		it = gst_buffer_list_iterate(list);
+		while(gst_buffer_list_iterator_next_group(it))
+		{
+			buf = gst_buffer_list_iterator_merge_group(it);
+			if(!buf)
+				continue;
+			gst_apprtpsink_render(sink, buf);
+			gst_buffer_unref(buf);
+		}
+		gst_buffer_list_iterator_free(it);
+		return GST_FLOW_OK;
+	}
+
+	// each group is one rtp packet.  groups of a single buffer are passed
+	//   through as-is, and the rest are merged into one contiguous packet,
+	//   which copies.  our own payloaders don't push lists for this
+	//   reason.  the lists we get are from rtppacer, which only puts
+	//   single buffers in them
+
+	// anything held back goes first, to keep the order
+	pending_flush(self);
+
+	count = gst_buffer_list_n_groups(list);
+	if(count == 0)
+		return GST_FLOW_OK;
+
+	bufs = g_new(GstBuffer *, count);
+	at = 0;
+
+	it = gst_buffer_list_iterate(list);
+	while(gst_buffer_list_iterator_next_group(it))
+	{
+		if(gst_buffer_list_iterator_n_buffers(it) == 1)
+			buf = gst_buffer_ref(gst_buffer_list_iterator_next(it));
+		else
+			buf = gst_buffer_list_iterator_merge_group(it);
+
+		if(buf)
+			bufs[at++] = buf;
+	}
+	gst_buffer_list_iterator_free(it);
+
+	if(at > 0)
+		self->packets_ready(bufs, (int)at, self->appdata);
+
+	for(n = 0; n < at; ++n)
+		gst_buffer_unref(bufs[n]);
+	g_free(bufs);
+
+	return GST_FLOW_OK;
+}
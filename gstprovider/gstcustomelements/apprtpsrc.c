@@ -23,7 +23,225 @@
 #include "gstboilerplatefixed.h"
 #include <string.h>
 
+// capacity of the packet ring, and so the upper bound of max-packets.
+//   must be a power of 2
+#define APPRTPSRC_RING_SIZE 1024
+
+// default overflow policy
 #define APPRTPSRC_MAX_BUF_COUNT 32
+#define APPRTPSRC_MAX_BYTES 0 // unlimited
+#define APPRTPSRC_MAX_AGE 0 // unlimited
+
+// maximum number of recycled buffers in existence at once
+#define APPRTPSRC_POOL_SIZE 64
+
+//----------------------------------------------------------------------------
+// GstAppRtpSrcPool
+//----------------------------------------------------------------------------
+// buffers handed out by the pool are a GstBuffer subclass that, rather than
+//   being freed when downstream drops the last reference, releases the
+//   packet memory it wraps and then gets resurrected and put back into one
+//   of the pool slots.  only the buffer itself is recycled, since the
+//   packet memory belongs to the app.  the slots are claimed and filled
+//   with atomic compare-and-exchange, so buffers can be returned from any
+//   thread without a lock.  the pool itself is refcounted by the element
+//   and by every pooled buffer, since buffers can outlive the element.
+
+typedef struct _GstAppRtpSrcBuffer GstAppRtpSrcBuffer;
+typedef struct _GstAppRtpSrcBufferClass GstAppRtpSrcBufferClass;
+
+struct _GstAppRtpSrcPool
+{
+	volatile gint refs;
+	volatile gint active;
+	volatile gint created;
+	volatile gpointer slots[APPRTPSRC_POOL_SIZE];
+};
+
+struct _GstAppRtpSrcBuffer
+{
+	GstBuffer buffer;
+	GstAppRtpSrcPool *pool;
+};
+
+struct _GstAppRtpSrcBufferClass
+{
+	GstBufferClass buffer_class;
+};
+
+static GstMiniObjectClass *apprtpsrc_buffer_parent_class = NULL;
+
+static void apprtpsrc_pool_unref(GstAppRtpSrcPool *pool)
+{
+	if(g_atomic_int_dec_and_test(&pool->refs))
+		g_free(pool);
+}
+
+static gboolean apprtpsrc_pool_put(GstAppRtpSrcPool *pool, GstAppRtpSrcBuffer *buf)
+{
+	int n;
+
+	// the number of pooled buffers never exceeds the number of slots,
+	//   so there is always a free slot for a buffer being returned
+	for(n = 0; n < APPRTPSRC_POOL_SIZE; ++n)
+	{
+		if(g_atomic_pointer_compare_and_exchange(&pool->slots[n], NULL, buf))
+		{
+			// if the pool was shut down meanwhile, it may have
+			//   already been drained.  take the buffer back out
+			//   unless the drainer beat us to it
+			if(!g_atomic_int_get(&pool->active) && g_atomic_pointer_compare_and_exchange(&pool->slots[n], buf, NULL))
+				return FALSE;
+
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static void gst_apprtpsrc_buffer_finalize(GstAppRtpSrcBuffer *buf)
+{
+	GstAppRtpSrcPool *pool = buf->pool;
+	GstBuffer *gbuf = GST_BUFFER_CAST(buf);
+
+	if(g_atomic_int_get(&pool->active))
+	{
+		// hand the packet back to the app
+		if(GST_BUFFER_FREE_FUNC(gbuf) && GST_BUFFER_MALLOCDATA(gbuf))
+			GST_BUFFER_FREE_FUNC(gbuf)(GST_BUFFER_MALLOCDATA(gbuf));
+
+		// reset to a pristine state
+		gst_caps_replace(&GST_BUFFER_CAPS(gbuf), NULL);
+		GST_MINI_OBJECT_FLAGS(gbuf) = 0;
+		GST_BUFFER_DATA(gbuf) = NULL;
+		GST_BUFFER_SIZE(gbuf) = 0;
+		GST_BUFFER_MALLOCDATA(gbuf) = NULL;
+		GST_BUFFER_FREE_FUNC(gbuf) = g_free;
+		GST_BUFFER_TIMESTAMP(gbuf) = GST_CLOCK_TIME_NONE;
+		GST_BUFFER_DURATION(gbuf) = GST_CLOCK_TIME_NONE;
+		GST_BUFFER_OFFSET(gbuf) = GST_BUFFER_OFFSET_NONE;
+		GST_BUFFER_OFFSET_END(gbuf) = GST_BUFFER_OFFSET_NONE;
+
+		// resurrect.  the ref has to be taken before the buffer is
+		//   visible in the pool, since it may be handed out again
+		//   immediately
+		gst_buffer_ref(gbuf);
+		if(apprtpsrc_pool_put(pool, buf))
+			return;
+
+		// couldn't return it after all.  drop the ref we just took
+		//   without recursing back into finalize
+		g_atomic_int_add(&GST_MINI_OBJECT_REFCOUNT(gbuf), -1);
+	}
+
+	g_atomic_int_add(&pool->created, -1);
+	apprtpsrc_pool_unref(pool);
+	apprtpsrc_buffer_parent_class->finalize(GST_MINI_OBJECT_CAST(buf));
+}
+
+static void gst_apprtpsrc_buffer_class_init(gpointer g_class, gpointer class_data)
+{
+	GstMiniObjectClass *mini_object_class = GST_MINI_OBJECT_CLASS(g_class);
+	(void)class_data;
+
+	apprtpsrc_buffer_parent_class = (GstMiniObjectClass *)g_type_class_peek_parent(g_class);
+	mini_object_class->finalize = (GstMiniObjectFinalizeFunction)gst_apprtpsrc_buffer_finalize;
+}
+
+static GType gst_apprtpsrc_buffer_get_type(void)
+{
+	static GType type = 0;
+
+	if(G_UNLIKELY(type == 0))
+	{
+		static const GTypeInfo info =
+		{
+			sizeof(GstAppRtpSrcBufferClass),
+			NULL,
+			NULL,
+			gst_apprtpsrc_buffer_class_init,
+			NULL,
+			NULL,
+			sizeof(GstAppRtpSrcBuffer),
+			0,
+			NULL,
+			NULL
+		};
+		type = g_type_register_static(GST_TYPE_BUFFER, "GstAppRtpSrcBuffer", &info, (GTypeFlags)0);
+	}
+
+	return type;
+}
+
+static GstAppRtpSrcPool *apprtpsrc_pool_new()
+{
+	GstAppRtpSrcPool *pool = g_new0(GstAppRtpSrcPool, 1);
+	pool->refs = 1; // owned by the element
+	pool->active = 1;
+	pool->created = 0;
+	return pool;
+}
+
+// only the ingress thread calls this.  the buffer comes back empty, ready
+//   to wrap a packet.  *allocated is set to TRUE if a new buffer had to be
+//   created to satisfy the request
+static GstBuffer *apprtpsrc_pool_alloc(GstAppRtpSrcPool *pool, gboolean *allocated)
+{
+	GstAppRtpSrcBuffer *buf;
+	gpointer p;
+	int n;
+
+	// take a recycled buffer if we have one
+	for(n = 0; n < APPRTPSRC_POOL_SIZE; ++n)
+	{
+		p = g_atomic_pointer_get(&pool->slots[n]);
+		if(p && g_atomic_pointer_compare_and_exchange(&pool->slots[n], p, NULL))
+		{
+			*allocated = FALSE;
+			return GST_BUFFER_CAST(p);
+		}
+	}
+
+	*allocated = TRUE;
+
+	// otherwise grow the pool, up to its capacity.  it starts out empty,
+	//   so sources that see little traffic (rtcp) stay small
+	if(g_atomic_int_get(&pool->created) < APPRTPSRC_POOL_SIZE)
+	{
+		g_atomic_int_inc(&pool->created);
+		g_atomic_int_inc(&pool->refs);
+
+		buf = (GstAppRtpSrcBuffer *)gst_mini_object_new(gst_apprtpsrc_buffer_get_type());
+		buf->pool = pool;
+		return GST_BUFFER_CAST(buf);
+	}
+
+	return gst_buffer_new();
+}
+
+static void apprtpsrc_pool_shutdown(GstAppRtpSrcPool *pool)
+{
+	gpointer p;
+	int n;
+
+	g_atomic_int_set(&pool->active, 0);
+
+	// free whatever is resting in the pool.  buffers still in use
+	//   downstream will be freed normally when they are dropped
+	for(n = 0; n < APPRTPSRC_POOL_SIZE; ++n)
+	{
+		p = g_atomic_pointer_get(&pool->slots[n]);
+		if(p && g_atomic_pointer_compare_and_exchange(&pool->slots[n], p, NULL))
+			gst_buffer_unref(GST_BUFFER_CAST(p));
+	}
+
+	apprtpsrc_pool_unref(pool);
+}
+
+//----------------------------------------------------------------------------
+// GstAppRtpSrc
+//----------------------------------------------------------------------------
 
 GST_BOILERPLATE(GstAppRtpSrc, gst_apprtpsrc, GstPushSrc, GST_TYPE_PUSH_SRC);
 
@@ -32,6 +250,13 @@ enum
 	PROP_0,
 
 	PROP_CAPS,
+	PROP_COPIED_PACKETS,
+	PROP_ALLOCATED_BUFFERS,
+	PROP_MAX_PACKETS,
+	PROP_MAX_BYTES,
+	PROP_MAX_AGE,
+	PROP_DROPPED_PACKETS,
+	PROP_DROPPED_BYTES,
 
 	PROP_LAST
 };
@@ -39,6 +264,8 @@ enum
 static void gst_apprtpsrc_set_property(GObject *obj, guint prop_id, const GValue *value, GParamSpec *pspec);
 static void gst_apprtpsrc_get_property(GObject *obj, guint prop_id, GValue *value, GParamSpec *pspec);
 static void gst_apprtpsrc_finalize(GObject *obj);
+static gboolean gst_apprtpsrc_set_clock(GstElement *element, GstClock *clock);
+static GstStateChangeReturn gst_apprtpsrc_change_state(GstElement *element, GstStateChange transition);
 static gboolean gst_apprtpsrc_unlock(GstBaseSrc *src);
 static gboolean gst_apprtpsrc_unlock_stop(GstBaseSrc *src);
 static GstCaps *gst_apprtpsrc_get_caps(GstBaseSrc *src);
@@ -69,10 +296,12 @@ void gst_apprtpsrc_base_init(gpointer gclass)
 void gst_apprtpsrc_class_init(GstAppRtpSrcClass *klass)
 {
 	GObjectClass *gobject_class;
+	GstElementClass *element_class;
 	GstBaseSrcClass *basesrc_class;
 	GstPushSrcClass *pushsrc_class;
 
 	gobject_class = (GObjectClass *)klass;
+	element_class = (GstElementClass *)klass;
 	basesrc_class = (GstBaseSrcClass *)klass;
 	pushsrc_class = (GstPushSrcClass *)klass;
 
@@ -85,6 +314,44 @@ void gst_apprtpsrc_class_init(GstAppRtpSrcClass *klass)
 		"The caps of the source pad", GST_TYPE_CAPS,
 		G_PARAM_READWRITE));
 
+	g_object_class_install_property(gobject_class, PROP_COPIED_PACKETS,
+		g_param_spec_int("copied-packets", "Copied packets",
+		"Number of pushed packets that had to be copied", 0, G_MAXINT, 0,
+		G_PARAM_READABLE));
+
+	g_object_class_install_property(gobject_class, PROP_ALLOCATED_BUFFERS,
+		g_param_spec_int("allocated-buffers", "Allocated buffers",
+		"Number of pushed packets that needed a new buffer", 0, G_MAXINT, 0,
+		G_PARAM_READABLE));
+
+	g_object_class_install_property(gobject_class, PROP_MAX_PACKETS,
+		g_param_spec_int("max-packets", "Max packets",
+		"Maximum number of queued packets", 1, APPRTPSRC_RING_SIZE, APPRTPSRC_MAX_BUF_COUNT,
+		G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_MAX_BYTES,
+		g_param_spec_int("max-bytes", "Max bytes",
+		"Maximum number of queued bytes (0 = unlimited)", 0, G_MAXINT, APPRTPSRC_MAX_BYTES,
+		G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_MAX_AGE,
+		g_param_spec_int("max-age", "Max age",
+		"Drop queued packets older than this, in ms (0 = unlimited)", 0, G_MAXINT, APPRTPSRC_MAX_AGE,
+		G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_DROPPED_PACKETS,
+		g_param_spec_uint64("dropped-packets", "Dropped packets",
+		"Number of packets dropped due to the overflow policy", 0, G_MAXUINT64, 0,
+		G_PARAM_READABLE));
+
+	g_object_class_install_property(gobject_class, PROP_DROPPED_BYTES,
+		g_param_spec_uint64("dropped-bytes", "Dropped bytes",
+		"Number of bytes dropped due to the overflow policy", 0, G_MAXUINT64, 0,
+		G_PARAM_READABLE));
+
+	element_class->set_clock = gst_apprtpsrc_set_clock;
+	element_class->change_state = gst_apprtpsrc_change_state;
+
 	basesrc_class->unlock = gst_apprtpsrc_unlock;
 	basesrc_class->unlock_stop = gst_apprtpsrc_unlock_stop;
 	basesrc_class->get_caps = gst_apprtpsrc_get_caps;
@@ -97,10 +364,33 @@ void gst_apprtpsrc_init(GstAppRtpSrc *src, GstAppRtpSrcClass *gclass)
 {
 	(void)gclass;
 
-	src->buffers = g_queue_new();
+	src->ring_size = APPRTPSRC_RING_SIZE;
+	src->ring = g_new0(GstBuffer *, src->ring_size);
+	src->ring_ts = g_new0(GstClockTime, src->ring_size);
+	src->ring_sizes = g_new0(gint, src->ring_size);
+	src->ring_head = 0;
+	src->ring_tail = 0;
+	src->queued_bytes = 0;
+	src->max_packets = APPRTPSRC_MAX_BUF_COUNT;
+	src->max_bytes = APPRTPSRC_MAX_BYTES;
+	src->max_age = APPRTPSRC_MAX_AGE;
+	src->push_dropped_seq = 0;
+	src->push_dropped_packets = 0;
+	src->push_dropped_bytes = 0;
+	src->pop_dropped_seq = 0;
+	src->pop_dropped_packets = 0;
+	src->pop_dropped_bytes = 0;
+	src->clock_seq = 0;
+	src->cached_clock = NULL;
+	src->cached_base_time = 0;
+	src->held_clocks = NULL;
 	src->push_mutex = g_mutex_new();
 	src->push_cond = g_cond_new();
-	src->quit = FALSE; // not flushing
+	src->waiting = 0;
+	src->quit = 0; // not flushing
+	src->pool = apprtpsrc_pool_new();
+	src->copied_packets = 0;
+	src->allocated_buffers = 0;
 	src->caps = 0;
 
 	// set up the base (adapted from udpsrc)
@@ -109,39 +399,240 @@ void gst_apprtpsrc_init(GstAppRtpSrc *src, GstAppRtpSrcClass *gclass)
 	gst_base_src_set_live(GST_BASE_SRC(src), TRUE);
 	// make basesrc output a segment in time
 	gst_base_src_set_format(GST_BASE_SRC(src), GST_FORMAT_TIME);
-	// make basesrc set timestamps on outgoing buffers based on the
-	//   running_time when they were captured
-	gst_base_src_set_do_timestamp(GST_BASE_SRC(src), TRUE);
+	// we set timestamps ourselves, based on the running_time when the
+	//   packet was pushed.  basesrc would use the time of dequeuing
+	//   instead, which adds the streaming thread's scheduling delay to
+	//   the jitter seen downstream
+	gst_base_src_set_do_timestamp(GST_BASE_SRC(src), FALSE);
 }
 
-// destruct
-static void my_foreach_func(gpointer data, gpointer user_data)
+// only called from state changes, which the state lock serializes
+static void cache_clock(GstAppRtpSrc *src, GstClock *clock, GstClockTime base_time)
+{
+	if(clock && !g_slist_find(src->held_clocks, clock))
+		src->held_clocks = g_slist_prepend(src->held_clocks, gst_object_ref(clock));
+
+	// odd while writing
+	g_atomic_int_inc(&src->clock_seq);
+	src->cached_clock = clock;
+	src->cached_base_time = base_time;
+	g_atomic_int_inc(&src->clock_seq);
+}
+
+// returns the current running_time, or GST_CLOCK_TIME_NONE if we don't
+//   have a clock yet.  takes no locks
+static GstClockTime running_time_now(GstAppRtpSrc *src)
+{
+	GstClock *clock;
+	GstClockTime base_time;
+	GstClockTime now;
+	gint seq;
+
+	do
+	{
+		seq = g_atomic_int_get(&src->clock_seq);
+		clock = src->cached_clock;
+		base_time = src->cached_base_time;
+	} while((seq & 1) || g_atomic_int_get(&src->clock_seq) != seq);
+
+	if(!clock)
+		return GST_CLOCK_TIME_NONE;
+
+	now = gst_clock_get_time(clock);
+	if(now < base_time)
+		return 0;
+	return now - base_time;
+}
+
+static void drops_add(volatile gint *seq, guint64 *packets, guint64 *bytes, gint size)
+{
+	g_atomic_int_inc(seq);
+	++(*packets);
+	*bytes += size;
+	g_atomic_int_inc(seq);
+}
+
+static void drops_get(volatile gint *seq, const guint64 *packets, const guint64 *bytes, guint64 *out_packets, guint64 *out_bytes)
+{
+	gint n;
+
+	do
+	{
+		n = g_atomic_int_get(seq);
+		*out_packets = *packets;
+		*out_bytes = *bytes;
+	} while((n & 1) || g_atomic_int_get(seq) != n);
+}
+
+// the streaming thread calls this to take the oldest packet.  the tail is
+//   advanced with compare-and-exchange, since the app thread may evict the
+//   same packet concurrently.
+static GstBuffer *ring_pop(GstAppRtpSrc *src)
 {
-	GstBuffer *buf = (GstBuffer *)data;
-	(void)user_data;
-	gst_buffer_unref(buf);
+	gint head, tail;
+	GstBuffer *buf;
+
+	while(1)
+	{
+		tail = g_atomic_int_get(&src->ring_tail);
+		head = g_atomic_int_get(&src->ring_head);
+		if(head == tail)
+			return NULL;
+
+		buf = src->ring[tail & (src->ring_size - 1)];
+		if(g_atomic_int_compare_and_exchange(&src->ring_tail, tail, tail + 1))
+		{
+			g_atomic_int_add(&src->queued_bytes, -(gint)GST_BUFFER_SIZE(buf));
+			return buf;
+		}
+	}
 }
 
+// the app thread calls this to drop the oldest packet.  fails if the
+//   streaming thread took it first
+static gboolean ring_evict(GstAppRtpSrc *src, gint tail)
+{
+	int at = tail & (src->ring_size - 1);
+	GstBuffer *old;
+
+	old = src->ring[at];
+	if(!g_atomic_int_compare_and_exchange(&src->ring_tail, tail, tail + 1))
+		return FALSE;
+
+	g_atomic_int_add(&src->queued_bytes, -src->ring_sizes[at]);
+	drops_add(&src->push_dropped_seq, &src->push_dropped_packets, &src->push_dropped_bytes, src->ring_sizes[at]);
+	gst_buffer_unref(old);
+	return TRUE;
+}
+
+// the app thread calls this to append a packet, first evicting old
+//   packets as needed to satisfy the overflow policy.  the timestamps and
+//   sizes of queued packets are mirrored in arrays that only this thread
+//   writes, so we never have to look inside a buffer that the streaming
+//   thread might be in the middle of taking.
+static void ring_push(GstAppRtpSrc *src, GstBuffer *buf)
+{
+	gint head, tail;
+	gint size, max_packets, max_bytes;
+	GstClockTime arrival, max_age, ts;
+	int at;
+
+	head = src->ring_head; // only we write this
+	size = GST_BUFFER_SIZE(buf);
+	arrival = GST_BUFFER_TIMESTAMP(buf);
+	max_packets = g_atomic_int_get(&src->max_packets);
+	max_bytes = g_atomic_int_get(&src->max_bytes);
+	max_age = (GstClockTime)g_atomic_int_get(&src->max_age) * GST_MSECOND;
+
+	while(1)
+	{
+		tail = g_atomic_int_get(&src->ring_tail);
+		if(head == tail)
+			break;
+
+		if(head - tail >= max_packets)
+		{
+			ring_evict(src, tail);
+			continue;
+		}
+
+		if(max_bytes > 0 && g_atomic_int_get(&src->queued_bytes) + size > max_bytes)
+		{
+			ring_evict(src, tail);
+			continue;
+		}
+
+		if(max_age > 0 && GST_CLOCK_TIME_IS_VALID(arrival))
+		{
+			ts = src->ring_ts[tail & (src->ring_size - 1)];
+			if(GST_CLOCK_TIME_IS_VALID(ts) && arrival > ts && arrival - ts > max_age)
+			{
+				ring_evict(src, tail);
+				continue;
+			}
+		}
+
+		break;
+	}
+
+	at = head & (src->ring_size - 1);
+	src->ring[at] = buf;
+	src->ring_ts[at] = arrival;
+	src->ring_sizes[at] = size;
+	g_atomic_int_add(&src->queued_bytes, size);
+	g_atomic_int_set(&src->ring_head, head + 1);
+}
+
+static void ring_clear(GstAppRtpSrc *src)
+{
+	GstBuffer *buf;
+
+	while((buf = ring_pop(src)) != NULL)
+		gst_buffer_unref(buf);
+}
+
+// destruct
 void gst_apprtpsrc_finalize(GObject *obj)
 {
 	GstAppRtpSrc *src = (GstAppRtpSrc *)obj;
 
-	g_queue_foreach(src->buffers, my_foreach_func, NULL);
-	g_queue_free(src->buffers);
+	ring_clear(src);
+	g_free(src->ring);
+	g_free(src->ring_ts);
+	g_free(src->ring_sizes);
+	apprtpsrc_pool_shutdown(src->pool);
 	g_mutex_free(src->push_mutex);
 	g_cond_free(src->push_cond);
 	if(src->caps)
 		gst_caps_unref(src->caps);
+	g_slist_foreach(src->held_clocks, (GFunc)gst_object_unref, NULL);
+	g_slist_free(src->held_clocks);
 
 	G_OBJECT_CLASS(parent_class)->finalize(obj);
 }
 
+gboolean gst_apprtpsrc_set_clock(GstElement *element, GstClock *clock)
+{
+	GstAppRtpSrc *src = (GstAppRtpSrc *)element;
+	GstClockTime base_time;
+
+	if(GST_ELEMENT_CLASS(parent_class)->set_clock && !GST_ELEMENT_CLASS(parent_class)->set_clock(element, clock))
+		return FALSE;
+
+	GST_OBJECT_LOCK(src);
+	base_time = element->base_time;
+	GST_OBJECT_UNLOCK(src);
+
+	cache_clock(src, clock, base_time);
+	return TRUE;
+}
+
+GstStateChangeReturn gst_apprtpsrc_change_state(GstElement *element, GstStateChange transition)
+{
+	GstAppRtpSrc *src = (GstAppRtpSrc *)element;
+	GstClock *clock;
+	GstClockTime base_time;
+
+	// the bin hands out base_time just before going to playing
+	if(transition == GST_STATE_CHANGE_PAUSED_TO_PLAYING)
+	{
+		GST_OBJECT_LOCK(src);
+		clock = GST_ELEMENT_CLOCK(src);
+		base_time = element->base_time;
+		GST_OBJECT_UNLOCK(src);
+
+		cache_clock(src, clock, base_time);
+	}
+
+	return GST_ELEMENT_CLASS(parent_class)->change_state(element, transition);
+}
+
 gboolean gst_apprtpsrc_unlock(GstBaseSrc *bsrc)
 {
 	GstAppRtpSrc *src = (GstAppRtpSrc *)bsrc;
 
 	g_mutex_lock(src->push_mutex);
-	src->quit = TRUE; // flushing
+	g_atomic_int_set(&src->quit, 1); // flushing
 	g_cond_signal(src->push_cond);
 	g_mutex_unlock(src->push_mutex);
 
@@ -153,7 +644,7 @@ gboolean gst_apprtpsrc_unlock_stop(GstBaseSrc *bsrc)
 	GstAppRtpSrc *src = (GstAppRtpSrc *)bsrc;
 
 	g_mutex_lock(src->push_mutex);
-	src->quit = FALSE; // not flushing
+	g_atomic_int_set(&src->quit, 0); // not flushing
 	g_mutex_unlock(src->push_mutex);
 
 	return TRUE;
@@ -172,6 +663,11 @@ GstCaps *gst_apprtpsrc_get_caps(GstBaseSrc *bsrc)
 GstFlowReturn gst_apprtpsrc_create(GstPushSrc *bsrc, GstBuffer **buf)
 {
 	GstAppRtpSrc *src = (GstAppRtpSrc *)bsrc;
+	GstBuffer *newbuf;
+	GstClockTime max_age, now, ts;
+
+	max_age = (GstClockTime)g_atomic_int_get(&src->max_age) * GST_MSECOND;
+	now = GST_CLOCK_TIME_NONE;
 
 	// the assumption here is that every buffer is a complete rtp
 	//   packet, ready for processing
@@ -179,49 +675,178 @@ GstFlowReturn gst_apprtpsrc_create(GstPushSrc *bsrc, GstBuffer **buf)
 	// i believe the app is supposed to block on this call waiting for
 	//   data
 
-	g_mutex_lock(src->push_mutex);
+	while(1)
+	{
+		// flushing?
+		if(g_atomic_int_get(&src->quit))
+			return GST_FLOW_WRONG_STATE;
 
-	while(g_queue_is_empty(src->buffers) && !src->quit)
-		g_cond_wait(src->push_cond, src->push_mutex);
+		newbuf = ring_pop(src);
+		if(newbuf)
+		{
+			// if we've fallen behind, packets may have gone stale
+			//   while sitting in the queue
+			ts = GST_BUFFER_TIMESTAMP(newbuf);
+			if(max_age > 0 && GST_CLOCK_TIME_IS_VALID(ts))
+			{
+				if(!GST_CLOCK_TIME_IS_VALID(now))
+					now = running_time_now(src);
+
+				if(GST_CLOCK_TIME_IS_VALID(now) && now > ts && now - ts > max_age)
+				{
+					drops_add(&src->pop_dropped_seq, &src->pop_dropped_packets, &src->pop_dropped_bytes, GST_BUFFER_SIZE(newbuf));
+					gst_buffer_unref(newbuf);
+					continue;
+				}
+			}
 
-	// flushing?
-	if(src->quit)
-	{
+			break;
+		}
+
+		// nothing queued.  announce that we're going to sleep, then
+		//   check again before actually sleeping, so that a racing push
+		//   either lands in the ring or sees the flag and wakes us up
+		g_mutex_lock(src->push_mutex);
+		g_atomic_int_set(&src->waiting, 1);
+		while(g_atomic_int_get(&src->ring_head) == g_atomic_int_get(&src->ring_tail) && !g_atomic_int_get(&src->quit))
+			g_cond_wait(src->push_cond, src->push_mutex);
+		g_atomic_int_set(&src->waiting, 0);
 		g_mutex_unlock(src->push_mutex);
-		return GST_FLOW_WRONG_STATE;
+
+		now = GST_CLOCK_TIME_NONE;
 	}
 
-	*buf = (GstBuffer *)g_queue_pop_head(src->buffers);
-	gst_buffer_set_caps(*buf, src->caps);
+	// packets pushed before we had a clock get stamped now instead, the
+	//   same as basesrc would have done
+	if(!GST_BUFFER_TIMESTAMP_IS_VALID(newbuf))
+		GST_BUFFER_TIMESTAMP(newbuf) = running_time_now(src);
 
-	g_mutex_unlock(src->push_mutex);
+	gst_buffer_set_caps(newbuf, src->caps);
+	*buf = newbuf;
 
 	return GST_FLOW_OK;
 }
 
-void gst_apprtpsrc_packet_push(GstAppRtpSrc *src, const unsigned char *buf, int size)
+static void push_one_wrapped(GstAppRtpSrc *src, const unsigned char *buf, int size, GFreeFunc free_func, gpointer free_data, GstClockTime arrival)
 {
 	GstBuffer *newbuf;
+	gboolean allocated;
+
+	// the buffer points straight at the caller's memory.  when the last
+	//   reference is dropped, free_data is handed to free_func
+	newbuf = apprtpsrc_pool_alloc(src->pool, &allocated);
+	if(allocated)
+		g_atomic_int_inc(&src->allocated_buffers);
+
+	GST_BUFFER_DATA(newbuf) = (guint8 *)buf;
+	GST_BUFFER_SIZE(newbuf) = size;
+	GST_BUFFER_MALLOCDATA(newbuf) = (guint8 *)free_data;
+	GST_BUFFER_FREE_FUNC(newbuf) = free_func;
+	GST_BUFFER_FLAG_SET(newbuf, GST_BUFFER_FLAG_READONLY);
+	GST_BUFFER_TIMESTAMP(newbuf) = arrival;
+
+	// if buffer is full, the oldest is eaten to make room
+	ring_push(src, newbuf);
+}
 
-	g_mutex_lock(src->push_mutex);
+static void push_one(GstAppRtpSrc *src, const unsigned char *buf, int size, GstClockTime arrival)
+{
+	guint8 *data;
 
-	// if buffer is full, eat the oldest to make room
-	if(g_queue_get_length(src->buffers) >= APPRTPSRC_MAX_BUF_COUNT)
-		g_queue_pop_head(src->buffers);
+	data = (guint8 *)g_malloc(size);
+	memcpy(data, buf, size);
+	g_atomic_int_inc(&src->copied_packets);
 
+	push_one_wrapped(src, data, size, g_free, data, arrival);
+}
+
+static void wake(GstAppRtpSrc *src)
+{
+	// only take the lock if the streaming thread is asleep
+	if(g_atomic_int_get(&src->waiting))
+	{
+		g_mutex_lock(src->push_mutex);
+		g_cond_signal(src->push_cond);
+		g_mutex_unlock(src->push_mutex);
+	}
+}
+
+// note: this must not be called from more than one thread at a time
+void gst_apprtpsrc_packet_push(GstAppRtpSrc *src, const unsigned char *buf, int size)
+{
 	// ignore zero-byte packets
 	if(size < 1)
+		return;
+
+	push_one(src, buf, size, running_time_now(src));
+	wake(src);
+}
+
+// same as above, but the streaming thread is woken at most once for the
+//   whole set
+void gst_apprtpsrc_packet_push_many(GstAppRtpSrc *src, const unsigned char **bufs, const int *sizes, int count)
+{
+	int n;
+	gboolean pushed = FALSE;
+	GstClockTime arrival;
+
+	// the whole set arrived together
+	arrival = running_time_now(src);
+
+	for(n = 0; n < count; ++n)
 	{
-		g_mutex_unlock(src->push_mutex);
+		// ignore zero-byte packets
+		if(sizes[n] < 1)
+			continue;
+
+		push_one(src, bufs[n], sizes[n], arrival);
+		pushed = TRUE;
+	}
+
+	if(pushed)
+		wake(src);
+}
+
+// note: this must not be called from more than one thread at a time
+void gst_apprtpsrc_packet_push_wrapped(GstAppRtpSrc *src, const unsigned char *buf, int size, GFreeFunc free_func, gpointer free_data)
+{
+	// ignore zero-byte packets
+	if(size < 1)
+	{
+		free_func(free_data);
 		return;
 	}
 
-	newbuf = gst_buffer_new_and_alloc(size);
-	memcpy(GST_BUFFER_DATA(newbuf), buf, size);
-	g_queue_push_tail(src->buffers, newbuf);
+	push_one_wrapped(src, buf, size, free_func, free_data, running_time_now(src));
+	wake(src);
+}
 
-	g_cond_signal(src->push_cond);
-	g_mutex_unlock(src->push_mutex);
+// same as above, but the streaming thread is woken at most once for the
+//   whole set
+void gst_apprtpsrc_packet_push_wrapped_many(GstAppRtpSrc *src, const unsigned char **bufs, const int *sizes, GFreeFunc free_func, gpointer *free_datas, int count)
+{
+	int n;
+	gboolean pushed = FALSE;
+	GstClockTime arrival;
+
+	// the whole set arrived together
+	arrival = running_time_now(src);
+
+	for(n = 0; n < count; ++n)
+	{
+		// ignore zero-byte packets
+		if(sizes[n] < 1)
+		{
+			free_func(free_datas[n]);
+			continue;
+		}
+
+		push_one_wrapped(src, bufs[n], sizes[n], free_func, free_datas[n], arrival);
+		pushed = TRUE;
+	}
+
+	if(pushed)
+		wake(src);
 }
 
 void gst_apprtpsrc_set_property(GObject *obj, guint prop_id, const GValue *value, GParamSpec *pspec)
@@ -231,6 +856,15 @@ void gst_apprtpsrc_set_property(GObject *obj, guint prop_id, const GValue *value
 
 	switch(prop_id)
 	{
+		case PROP_MAX_PACKETS:
+			g_atomic_int_set(&src->max_packets, g_value_get_int(value));
+			break;
+		case PROP_MAX_BYTES:
+			g_atomic_int_set(&src->max_bytes, g_value_get_int(value));
+			break;
+		case PROP_MAX_AGE:
+			g_atomic_int_set(&src->max_age, g_value_get_int(value));
+			break;
 		case PROP_CAPS:
 		{
 			const GstCaps *new_caps_val = gst_value_get_caps(value);
@@ -255,12 +889,38 @@ void gst_apprtpsrc_set_property(GObject *obj, guint prop_id, const GValue *value
 void gst_apprtpsrc_get_property(GObject *obj, guint prop_id, GValue *value, GParamSpec *pspec)
 {
 	GstAppRtpSrc *src = (GstAppRtpSrc *)obj;
+	guint64 push_packets, push_bytes, pop_packets, pop_bytes;
 
 	switch(prop_id)
 	{
 		case PROP_CAPS:
 			gst_value_set_caps(value, src->caps);
 			break;
+		case PROP_COPIED_PACKETS:
+			g_value_set_int(value, g_atomic_int_get(&src->copied_packets));
+			break;
+		case PROP_ALLOCATED_BUFFERS:
+			g_value_set_int(value, g_atomic_int_get(&src->allocated_buffers));
+			break;
+		case PROP_MAX_PACKETS:
+			g_value_set_int(value, g_atomic_int_get(&src->max_packets));
+			break;
+		case PROP_MAX_BYTES:
+			g_value_set_int(value, g_atomic_int_get(&src->max_bytes));
+			break;
+		case PROP_MAX_AGE:
+			g_value_set_int(value, g_atomic_int_get(&src->max_age));
+			break;
+		case PROP_DROPPED_PACKETS:
+			drops_get(&src->push_dropped_seq, &src->push_dropped_packets, &src->push_dropped_bytes, &push_packets, &push_bytes);
+			drops_get(&src->pop_dropped_seq, &src->pop_dropped_packets, &src->pop_dropped_bytes, &pop_packets, &pop_bytes);
+			g_value_set_uint64(value, push_packets + pop_packets);
+			break;
+		case PROP_DROPPED_BYTES:
+			drops_get(&src->push_dropped_seq, &src->push_dropped_packets, &src->push_dropped_bytes, &push_packets, &push_bytes);
+			drops_get(&src->pop_dropped_seq, &src->pop_dropped_packets, &src->pop_dropped_bytes, &pop_packets, &pop_bytes);
+			g_value_set_uint64(value, push_bytes + pop_bytes);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
 			break;
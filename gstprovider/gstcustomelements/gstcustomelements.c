@@ -40,6 +40,12 @@ static gboolean register_elements(GstPlugin *plugin)
 		return FALSE;
 	}
 
+	if(!gst_element_register(plugin, "rtppacer",
+		GST_RANK_NONE, GST_TYPE_RTPPACER))
+	{
+		return FALSE;
+	}
+
 	return TRUE;
 }
 
@@ -29,11 +29,12 @@
 
 G_BEGIN_DECLS
 
-// We create three custom elements here
+// We create four custom elements here
 //
 //   appvideosink - grab raw decoded frames, ready for painting
 //   apprtpsrc    - allow the app to feed in RTP packets
 //   apprtpsink   - allow the app to collect RTP packets
+//   rtppacer     - smooth out bursts of outgoing RTP packets
 
 // set up the defines/typedefs
 
@@ -79,6 +80,20 @@ typedef struct _GstAppRtpSrcClass GstAppRtpSrcClass;
 typedef struct _GstAppRtpSink      GstAppRtpSink;
 typedef struct _GstAppRtpSinkClass GstAppRtpSinkClass;
 
+#define GST_TYPE_RTPPACER \
+  (gst_rtppacer_get_type())
+#define GST_RTPPACER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_RTPPACER,GstRtpPacer))
+#define GST_RTPPACER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_RTPPACER,GstRtpPacerClass))
+#define GST_IS_RTPPACER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_RTPPACER))
+#define GST_IS_RTPPACER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_RTPPACER))
+
+typedef struct _GstRtpPacer      GstRtpPacer;
+typedef struct _GstRtpPacerClass GstRtpPacerClass;
+
 // done with defines/typedefs
 
 // GstAppVideoSink
@@ -100,14 +115,63 @@ GType gst_appvideosink_get_type(void);
 
 // GstAppRtpSrc
 
+typedef struct _GstAppRtpSrcPool GstAppRtpSrcPool;
+
 struct _GstAppRtpSrc
 {
 	GstPushSrc parent;
 
-	GQueue *buffers;
+	// single-producer/single-consumer ring of packets.  the app thread
+	//   only ever advances ring_head and the streaming thread only ever
+	//   advances ring_tail, except that the app thread may also bump
+	//   ring_tail (atomically) to evict the oldest packet on overflow.
+	GstBuffer **ring;
+	GstClockTime *ring_ts; // arrival times, written by the app thread
+	gint *ring_sizes; // packet sizes, written by the app thread
+	gint ring_size; // power of 2
+	volatile gint ring_head;
+	volatile gint ring_tail;
+	volatile gint queued_bytes;
+
+	// overflow policy
+	volatile gint max_packets;
+	volatile gint max_bytes;
+	volatile gint max_age; // ms
+
+	// drops made by the app thread (overflow) and by the streaming
+	//   thread (stale packets).  each pair has a single writer, which
+	//   bumps the sequence count around updates so readers can retry
+	//   instead of locking
+	volatile gint push_dropped_seq;
+	guint64 push_dropped_packets;
+	guint64 push_dropped_bytes;
+	volatile gint pop_dropped_seq;
+	guint64 pop_dropped_packets;
+	guint64 pop_dropped_bytes;
+
+	// the clock and base_time, cached at state changes so that stamping
+	//   a push doesn't need the object lock.  written under a sequence
+	//   count like the above.  every clock that gets cached is held until
+	//   finalize, so a reader can't be left with a freed one
+	volatile gint clock_seq;
+	GstClock *cached_clock;
+	GstClockTime cached_base_time;
+	GSList *held_clocks;
+
+	// the mutex and cond are only touched when the streaming thread has
+	//   run out of packets and needs to sleep
 	GMutex *push_mutex;
 	GCond *push_cond;
-	gboolean quit;
+	volatile gint waiting;
+	volatile gint quit;
+
+	// recycled buffers for wrapping pushed packets, so ingress doesn't
+	//   allocate.  allocated_buffers counts the pushes that did
+	GstAppRtpSrcPool *pool;
+	volatile gint allocated_buffers;
+
+	// for verifying the zero-copy path: pushes that went through memcpy
+	volatile gint copied_packets;
 
 	GstCaps *caps;
 };
@@ -118,7 +182,16 @@ struct _GstAppRtpSrcClass
 };
 
 GType gst_apprtpsrc_get_type(void);
+
+// these copy the packet, and count it in the copied-packets property
 void gst_apprtpsrc_packet_push(GstAppRtpSrc *src, const unsigned char *buf, int size);
+void gst_apprtpsrc_packet_push_many(GstAppRtpSrc *src, const unsigned char **bufs, const int *sizes, int count);
+
+// these take ownership of the packet memory rather than copying it.  the
+//   memory must stay valid and unmodified until free_func is called with
+//   free_data, which happens once downstream is done with the packet
+void gst_apprtpsrc_packet_push_wrapped(GstAppRtpSrc *src, const unsigned char *buf, int size, GFreeFunc free_func, gpointer free_data);
+void gst_apprtpsrc_packet_push_wrapped_many(GstAppRtpSrc *src, const unsigned char **bufs, const int *sizes, GFreeFunc free_func, gpointer *free_datas, int count);
 
 // GstAppRtpSink
 
@@ -128,6 +201,22 @@ struct _GstAppRtpSink
 
 	gpointer appdata;
 	void (*packet_ready)(const unsigned char *buf, int size, gpointer appdata);
+
+	// if set, this is called instead of packet_ready.  the app must take
+	//   its own reference if it wants to hold onto the buffer
+	void (*packet_ready_buffer)(GstBuffer *buf, gpointer appdata);
+
+	// if set, this is called instead of either of the above, with every
+	//   packet of a buffer list (e.g. a fragmented video frame) at once.
+	//   same ownership rules as packet_ready_buffer
+	void (*packets_ready)(GstBuffer **bufs, int count, gpointer appdata);
+
+	// with packets_ready, plain buffers can be held back until one with
+	//   the rtp marker bit (the end of a video frame) arrives, and the
+	//   frame handed over as one batch.  only for streams that set the
+	//   marker on every frame, and with nothing pacing in front of us
+	gboolean collect_frames;
+	GPtrArray *pending;
 };
 
 struct _GstAppRtpSinkClass
@@ -137,6 +226,63 @@ struct _GstAppRtpSinkClass
 
 GType gst_apprtpsink_get_type(void);
 
+// GstRtpPacer
+
+// a queued packet (a buffer, or a one-group buffer list) or serialized
+//   event
+typedef struct
+{
+	GstMiniObject *obj;
+	GstClockTime arrival; // system clock
+	gint size;
+} GstRtpPacerItem;
+
+struct _GstRtpPacer
+{
+	GstElement parent;
+
+	GstPad *sinkpad;
+	GstPad *srcpad;
+
+	// waits are made against the system clock and can be cut short by
+	//   a flush or a state change
+	GstClock *clock;
+	GMutex *lock;
+	GstClockID clock_id; // protected by lock
+	gboolean flushing; // protected by lock
+
+	// packets waiting to go out.  the chain function only queues, and
+	//   the src pad task does the waiting, so upstream never blocks on
+	//   pacing.  all protected by lock
+	GCond *cond;
+	GstRtpPacerItem *queue;
+	gint queue_head;
+	gint queue_count;
+	gint queued_packets;
+	GstFlowReturn srcresult;
+
+	// settings, may be changed while running
+	volatile gint bitrate; // kbps
+	volatile gint burst; // bytes
+
+	// token bucket, only touched by the streaming thread
+	gint64 tokens;
+	GstClockTime last_fill;
+
+	// stats, in us
+	volatile gint queue_delay;
+	volatile gint max_queue_delay;
+	guint64 delayed_packets; // protected by lock
+	guint64 dropped_packets; // protected by lock
+};
+
+struct _GstRtpPacerClass
+{
+	GstElementClass parent_class;
+};
+
+GType gst_rtppacer_get_type(void);
+
 void gstcustomelements_register();
 
 G_END_DECLS
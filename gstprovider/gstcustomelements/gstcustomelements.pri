@@ -5,4 +5,5 @@ SOURCES += \
 	$$PWD/gstcustomelements.c \
 	$$PWD/appvideosink.c \
 	$$PWD/apprtpsrc.c \
-	$$PWD/apprtpsink.c
+	$$PWD/apprtpsink.c \
+	$$PWD/rtppacer.c
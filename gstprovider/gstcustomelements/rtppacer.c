@@ -0,0 +1,680 @@
+/*
+ * Copyright (C) 2008  Barracuda Networks, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ *
+ */
+
+#include "gstcustomelements.h"
+
+#include "gstboilerplatefixed.h"
+
+// default bucket depth, about ten full-size packets
+#define RTPPACER_BURST 12000
+
+// a bucket that sat idle longer than this is simply full again.  this
+//   also keeps the token arithmetic from overflowing
+#define RTPPACER_MAX_IDLE (10 * GST_SECOND)
+
+// packets held at most, past which new ones are dropped.  the queue has
+//   room for events beyond this
+#define RTPPACER_MAX_PACKETS 256
+#define RTPPACER_QUEUE_SIZE 512 // must be a power of 2
+
+GST_BOILERPLATE(GstRtpPacer, gst_rtppacer, GstElement, GST_TYPE_ELEMENT);
+
+enum
+{
+	PROP_0,
+
+	PROP_BITRATE,
+	PROP_BURST,
+	PROP_QUEUE_DELAY,
+	PROP_MAX_QUEUE_DELAY,
+	PROP_DELAYED_PACKETS,
+	PROP_DROPPED_PACKETS,
+
+	PROP_LAST
+};
+
+static void gst_rtppacer_set_property(GObject *obj, guint prop_id, const GValue *value, GParamSpec *pspec);
+static void gst_rtppacer_get_property(GObject *obj, guint prop_id, GValue *value, GParamSpec *pspec);
+static void gst_rtppacer_finalize(GObject *obj);
+static GstStateChangeReturn gst_rtppacer_change_state(GstElement *element, GstStateChange transition);
+static gboolean gst_rtppacer_sink_event(GstPad *pad, GstEvent *event);
+static GstFlowReturn gst_rtppacer_chain(GstPad *pad, GstBuffer *buffer);
+static GstFlowReturn gst_rtppacer_chain_list(GstPad *pad, GstBufferList *list);
+static gboolean gst_rtppacer_src_activate_push(GstPad *pad, gboolean active);
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE("sink",
+	GST_PAD_SINK,
+	GST_PAD_ALWAYS,
+	GST_STATIC_CAPS_ANY
+	);
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE("src",
+	GST_PAD_SRC,
+	GST_PAD_ALWAYS,
+	GST_STATIC_CAPS_ANY
+	);
+
+void gst_rtppacer_base_init(gpointer gclass)
+{
+	static GstElementDetails element_details = GST_ELEMENT_DETAILS(
+		"RTP Pacer",
+		"Filter/Network",
+		"Spread bursts of RTP packets out over time",
+		"Justin Karneges <justin@affinix.com>"
+	);
+	GstElementClass *element_class = GST_ELEMENT_CLASS(gclass);
+
+	gst_element_class_add_pad_template(element_class,
+		gst_static_pad_template_get(&sink_template));
+	gst_element_class_add_pad_template(element_class,
+		gst_static_pad_template_get(&src_template));
+	gst_element_class_set_details(element_class, &element_details);
+}
+
+// class init
+void gst_rtppacer_class_init(GstRtpPacerClass *klass)
+{
+	GObjectClass *gobject_class;
+	GstElementClass *element_class;
+
+	gobject_class = (GObjectClass *)klass;
+	element_class = (GstElementClass *)klass;
+
+	gobject_class->set_property = gst_rtppacer_set_property;
+	gobject_class->get_property = gst_rtppacer_get_property;
+	gobject_class->finalize = gst_rtppacer_finalize;
+
+	g_object_class_install_property(gobject_class, PROP_BITRATE,
+		g_param_spec_int("bitrate", "Bitrate",
+		"Rate to pace packets out at, in kbps (0 = no pacing)", 0, G_MAXINT / 1000, 0,
+		G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_BURST,
+		g_param_spec_int("burst", "Burst",
+		"Number of bytes that may go out back to back after an idle period", 0, G_MAXINT / 8, RTPPACER_BURST,
+		G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_QUEUE_DELAY,
+		g_param_spec_int("queue-delay", "Queue delay",
+		"Time the most recent packet spent queued, in us", 0, G_MAXINT, 0,
+		G_PARAM_READABLE));
+
+	g_object_class_install_property(gobject_class, PROP_MAX_QUEUE_DELAY,
+		g_param_spec_int("max-queue-delay", "Max queue delay",
+		"Longest time any packet spent queued, in us", 0, G_MAXINT, 0,
+		G_PARAM_READABLE));
+
+	g_object_class_install_property(gobject_class, PROP_DELAYED_PACKETS,
+		g_param_spec_uint64("delayed-packets", "Delayed packets",
+		"Number of packets that had to be held back", 0, G_MAXUINT64, 0,
+		G_PARAM_READABLE));
+
+	g_object_class_install_property(gobject_class, PROP_DROPPED_PACKETS,
+		g_param_spec_uint64("dropped-packets", "Dropped packets",
+		"Number of packets dropped because too many were held back", 0, G_MAXUINT64, 0,
+		G_PARAM_READABLE));
+
+	element_class->change_state = gst_rtppacer_change_state;
+}
+
+// instance init
+void gst_rtppacer_init(GstRtpPacer *pacer, GstRtpPacerClass *gclass)
+{
+	(void)gclass;
+
+	pacer->sinkpad = gst_pad_new_from_static_template(&sink_template, "sink");
+	gst_pad_set_chain_function(pacer->sinkpad, gst_rtppacer_chain);
+	gst_pad_set_chain_list_function(pacer->sinkpad, gst_rtppacer_chain_list);
+	gst_pad_set_event_function(pacer->sinkpad, gst_rtppacer_sink_event);
+	gst_pad_set_getcaps_function(pacer->sinkpad, gst_pad_proxy_getcaps);
+	gst_pad_set_setcaps_function(pacer->sinkpad, gst_pad_proxy_setcaps);
+	gst_element_add_pad(GST_ELEMENT(pacer), pacer->sinkpad);
+
+	pacer->srcpad = gst_pad_new_from_static_template(&src_template, "src");
+	gst_pad_set_activatepush_function(pacer->srcpad, gst_rtppacer_src_activate_push);
+	gst_pad_set_getcaps_function(pacer->srcpad, gst_pad_proxy_getcaps);
+	gst_pad_set_setcaps_function(pacer->srcpad, gst_pad_proxy_setcaps);
+	gst_element_add_pad(GST_ELEMENT(pacer), pacer->srcpad);
+
+	// pacing is against real time, not the pipeline clock, which may
+	//   belong to a file or a remote party
+	pacer->clock = gst_system_clock_obtain();
+	pacer->lock = g_mutex_new();
+	pacer->clock_id = NULL;
+	pacer->flushing = TRUE; // until the src pad is activated
+
+	pacer->cond = g_cond_new();
+	pacer->queue = g_new0(GstRtpPacerItem, RTPPACER_QUEUE_SIZE);
+	pacer->queue_head = 0;
+	pacer->queue_count = 0;
+	pacer->queued_packets = 0;
+	pacer->srcresult = GST_FLOW_WRONG_STATE;
+
+	pacer->bitrate = 0;
+	pacer->burst = RTPPACER_BURST;
+
+	pacer->tokens = 0;
+	pacer->last_fill = GST_CLOCK_TIME_NONE;
+
+	pacer->queue_delay = 0;
+	pacer->max_queue_delay = 0;
+	pacer->delayed_packets = 0;
+	pacer->dropped_packets = 0;
+}
+
+// call with the lock held
+static void queue_clear(GstRtpPacer *pacer)
+{
+	GstRtpPacerItem *item;
+
+	while(pacer->queue_count > 0)
+	{
+		item = &pacer->queue[pacer->queue_head];
+		gst_mini_object_unref(item->obj);
+		item->obj = NULL;
+		pacer->queue_head = (pacer->queue_head + 1) & (RTPPACER_QUEUE_SIZE - 1);
+		--pacer->queue_count;
+	}
+	pacer->queued_packets = 0;
+}
+
+// destruct
+void gst_rtppacer_finalize(GObject *obj)
+{
+	GstRtpPacer *pacer = (GstRtpPacer *)obj;
+
+	queue_clear(pacer);
+	g_free(pacer->queue);
+	g_cond_free(pacer->cond);
+	g_mutex_free(pacer->lock);
+	gst_object_unref(pacer->clock);
+
+	G_OBJECT_CLASS(parent_class)->finalize(obj);
+}
+
+static void set_flushing(GstRtpPacer *pacer, gboolean flushing)
+{
+	g_mutex_lock(pacer->lock);
+	pacer->flushing = flushing;
+	if(flushing)
+	{
+		pacer->srcresult = GST_FLOW_WRONG_STATE;
+		if(pacer->clock_id)
+			gst_clock_id_unschedule(pacer->clock_id);
+		g_cond_signal(pacer->cond);
+	}
+	else
+	{
+		queue_clear(pacer);
+		pacer->srcresult = GST_FLOW_OK;
+	}
+	g_mutex_unlock(pacer->lock);
+}
+
+// sleep until the given system clock time.  returns FALSE if we were
+//   interrupted by a flush or a state change
+static gboolean wait_until(GstRtpPacer *pacer, GstClockTime when)
+{
+	GstClockID id;
+	GstClockReturn ret;
+
+	g_mutex_lock(pacer->lock);
+	if(pacer->flushing)
+	{
+		g_mutex_unlock(pacer->lock);
+		return FALSE;
+	}
+	id = gst_clock_new_single_shot_id(pacer->clock, when);
+	pacer->clock_id = id;
+	g_mutex_unlock(pacer->lock);
+
+	ret = gst_clock_id_wait(id, NULL);
+
+	g_mutex_lock(pacer->lock);
+	pacer->clock_id = NULL;
+	g_mutex_unlock(pacer->lock);
+	gst_clock_id_unref(id);
+
+	return ret != GST_CLOCK_UNSCHEDULED;
+}
+
+// token bucket.  tokens are kept in units of bytes * GST_SECOND so that
+//   refilling doesn't lose fractions of a byte.  a packet may go out as
+//   soon as the bucket is not in debt, and then puts it into debt by its
+//   size.  returns the byte rate, or 0 if we're not pacing
+static gint64 bucket_fill(GstRtpPacer *pacer, GstClockTime now)
+{
+	gint64 byterate, cap;
+	GstClockTime elapsed;
+
+	byterate = (gint64)g_atomic_int_get(&pacer->bitrate) * 1000 / 8;
+	if(byterate <= 0)
+		return 0;
+
+	cap = (gint64)g_atomic_int_get(&pacer->burst) * GST_SECOND;
+
+	if(!GST_CLOCK_TIME_IS_VALID(pacer->last_fill))
+	{
+		pacer->tokens = cap;
+		pacer->last_fill = now;
+	}
+
+	if(now > pacer->last_fill)
+	{
+		elapsed = now - pacer->last_fill;
+		if(elapsed > RTPPACER_MAX_IDLE)
+			elapsed = RTPPACER_MAX_IDLE;
+		pacer->tokens += (gint64)elapsed * byterate;
+		pacer->last_fill = now;
+	}
+
+	if(pacer->tokens > cap)
+		pacer->tokens = cap;
+
+	return byterate;
+}
+
+// returns when a packet of this size may go out
+static GstClockTime bucket_take(GstRtpPacer *pacer, GstClockTime now, int size)
+{
+	gint64 byterate;
+
+	byterate = bucket_fill(pacer, now);
+	if(byterate <= 0)
+		return now;
+
+	if(pacer->tokens < 0)
+		now += (GstClockTime)((-pacer->tokens + byterate - 1) / byterate);
+
+	pacer->tokens -= (gint64)size * GST_SECOND;
+	return now;
+}
+
+// whether a packet may go out right now
+static gboolean bucket_ready(GstRtpPacer *pacer, GstClockTime now)
+{
+	return bucket_fill(pacer, now) <= 0 || pacer->tokens >= 0;
+}
+
+// delay is from arrival at the sink pad to being sent
+static void record_delay(GstRtpPacer *pacer, GstClockTime delay)
+{
+	gint us;
+
+	us = (gint)MIN(delay / GST_USECOND, G_MAXINT);
+	g_atomic_int_set(&pacer->queue_delay, us);
+	if(us > g_atomic_int_get(&pacer->max_queue_delay))
+		g_atomic_int_set(&pacer->max_queue_delay, us);
+	if(us > 0)
+	{
+		g_mutex_lock(pacer->lock);
+		++pacer->delayed_packets;
+		g_mutex_unlock(pacer->lock);
+	}
+}
+
+// takes ownership of obj.  packets past the queue limit are dropped, and
+//   events wait for room, which only happens if the task is stuck
+static GstFlowReturn enqueue(GstRtpPacer *pacer, GstMiniObject *obj, int size, gboolean is_packet)
+{
+	GstRtpPacerItem *item;
+	GstClockTime arrival;
+	GstFlowReturn ret;
+
+	arrival = gst_clock_get_time(pacer->clock);
+
+	g_mutex_lock(pacer->lock);
+	while(1)
+	{
+		// a not-linked src is reported, but doesn't stop us
+		if(pacer->flushing || (pacer->srcresult != GST_FLOW_OK && pacer->srcresult != GST_FLOW_NOT_LINKED))
+		{
+			ret = pacer->flushing ? GST_FLOW_WRONG_STATE : pacer->srcresult;
+			g_mutex_unlock(pacer->lock);
+			gst_mini_object_unref(obj);
+			return ret;
+		}
+
+		if(is_packet && pacer->queued_packets >= RTPPACER_MAX_PACKETS)
+		{
+			++pacer->dropped_packets;
+			ret = pacer->srcresult;
+			g_mutex_unlock(pacer->lock);
+			gst_mini_object_unref(obj);
+			return ret;
+		}
+
+		if(pacer->queue_count < RTPPACER_QUEUE_SIZE)
+			break;
+
+		g_cond_wait(pacer->cond, pacer->lock);
+	}
+
+	item = &pacer->queue[(pacer->queue_head + pacer->queue_count) & (RTPPACER_QUEUE_SIZE - 1)];
+	item->obj = obj;
+	item->arrival = arrival;
+	item->size = size;
+	++pacer->queue_count;
+	if(is_packet)
+		++pacer->queued_packets;
+	ret = pacer->srcresult;
+	g_cond_signal(pacer->cond);
+	g_mutex_unlock(pacer->lock);
+
+	return ret;
+}
+
+static void pause_task(GstRtpPacer *pacer, GstFlowReturn ret)
+{
+	g_mutex_lock(pacer->lock);
+	if(pacer->srcresult == GST_FLOW_OK)
+		pacer->srcresult = ret;
+	g_mutex_unlock(pacer->lock);
+	gst_pad_pause_task(pacer->srcpad);
+}
+
+// call with the lock held, and with something queued
+static void queue_pop(GstRtpPacer *pacer, GstRtpPacerItem *item)
+{
+	*item = pacer->queue[pacer->queue_head];
+	pacer->queue[pacer->queue_head].obj = NULL;
+	pacer->queue_head = (pacer->queue_head + 1) & (RTPPACER_QUEUE_SIZE - 1);
+	--pacer->queue_count;
+	if(!GST_IS_EVENT(item->obj))
+		--pacer->queued_packets;
+
+	// room for a waiting event
+	g_cond_signal(pacer->cond);
+}
+
+// the src pad task.  sends the oldest queued item, waiting first if the
+//   bucket says so.  plain buffers queued behind it that the bucket lets
+//   straight through go out with it as one list, so that downstream sees
+//   a batch whenever pacing isn't holding us back
+static void gst_rtppacer_loop(GstRtpPacer *pacer)
+{
+	GstRtpPacerItem item;
+	GstClockTime now, when;
+	GstBufferList *list;
+	GstBufferListIterator *it;
+	GstFlowReturn ret;
+	gboolean is_eos;
+
+	g_mutex_lock(pacer->lock);
+	while(!pacer->flushing && pacer->queue_count == 0)
+		g_cond_wait(pacer->cond, pacer->lock);
+	if(pacer->flushing)
+	{
+		g_mutex_unlock(pacer->lock);
+		gst_pad_pause_task(pacer->srcpad);
+		return;
+	}
+
+	queue_pop(pacer, &item);
+	g_mutex_unlock(pacer->lock);
+
+	if(GST_IS_EVENT(item.obj))
+	{
+		is_eos = (GST_EVENT_TYPE(item.obj) == GST_EVENT_EOS);
+		gst_pad_push_event(pacer->srcpad, GST_EVENT_CAST(item.obj));
+		if(is_eos)
+			pause_task(pacer, GST_FLOW_UNEXPECTED);
+		return;
+	}
+
+	now = gst_clock_get_time(pacer->clock);
+	when = bucket_take(pacer, now, item.size);
+	if(when > now && !wait_until(pacer, when))
+	{
+		gst_mini_object_unref(item.obj);
+		pause_task(pacer, GST_FLOW_WRONG_STATE);
+		return;
+	}
+
+	record_delay(pacer, when > item.arrival ? when - item.arrival : 0);
+
+	if(GST_IS_BUFFER_LIST(item.obj))
+	{
+		ret = gst_pad_push_list(pacer->srcpad, GST_BUFFER_LIST_CAST(item.obj));
+	}
+	else
+	{
+		list = NULL;
+		it = NULL;
+		now = gst_clock_get_time(pacer->clock);
+
+		while(1)
+		{
+			g_mutex_lock(pacer->lock);
+			if(pacer->flushing || pacer->queue_count == 0 || !GST_IS_BUFFER(pacer->queue[pacer->queue_head].obj) || !bucket_ready(pacer, now))
+			{
+				g_mutex_unlock(pacer->lock);
+				break;
+			}
+
+			if(!list)
+			{
+				list = gst_buffer_list_new();
+				it = gst_buffer_list_iterate(list);
+				gst_buffer_list_iterator_add_group(it);
+				gst_buffer_list_iterator_add(it, GST_BUFFER_CAST(item.obj));
+			}
+
+			queue_pop(pacer, &item);
+			g_mutex_unlock(pacer->lock);
+
+			bucket_take(pacer, now, item.size);
+			record_delay(pacer, now > item.arrival ? now - item.arrival : 0);
+
+			gst_buffer_list_iterator_add_group(it);
+			gst_buffer_list_iterator_add(it, GST_BUFFER_CAST(item.obj));
+		}
+
+		if(list)
+		{
+			gst_buffer_list_iterator_free(it);
+			ret = gst_pad_push_list(pacer->srcpad, list);
+		}
+		else
+			ret = gst_pad_push(pacer->srcpad, GST_BUFFER_CAST(item.obj));
+	}
+
+	if(ret == GST_FLOW_NOT_LINKED)
+	{
+		g_mutex_lock(pacer->lock);
+		if(pacer->srcresult == GST_FLOW_OK)
+			pacer->srcresult = ret;
+		g_mutex_unlock(pacer->lock);
+	}
+	else if(ret != GST_FLOW_OK)
+		pause_task(pacer, ret);
+}
+
+gboolean gst_rtppacer_src_activate_push(GstPad *pad, gboolean active)
+{
+	GstRtpPacer *pacer = (GstRtpPacer *)GST_PAD_PARENT(pad);
+
+	if(active)
+	{
+		set_flushing(pacer, FALSE);
+		return gst_pad_start_task(pad, (GstTaskFunction)gst_rtppacer_loop, pacer);
+	}
+	else
+	{
+		// don't let a pending wait hold up the state change
+		set_flushing(pacer, TRUE);
+		return gst_pad_stop_task(pad);
+	}
+}
+
+GstStateChangeReturn gst_rtppacer_change_state(GstElement *element, GstStateChange transition)
+{
+	GstRtpPacer *pacer = (GstRtpPacer *)element;
+
+	// the task isn't running yet
+	if(transition == GST_STATE_CHANGE_READY_TO_PAUSED)
+	{
+		pacer->tokens = 0;
+		pacer->last_fill = GST_CLOCK_TIME_NONE;
+	}
+
+	return GST_ELEMENT_CLASS(parent_class)->change_state(element, transition);
+}
+
+gboolean gst_rtppacer_sink_event(GstPad *pad, GstEvent *event)
+{
+	GstRtpPacer *pacer = (GstRtpPacer *)GST_PAD_PARENT(pad);
+	gboolean ret;
+
+	switch(GST_EVENT_TYPE(event))
+	{
+		case GST_EVENT_FLUSH_START:
+			set_flushing(pacer, TRUE);
+			ret = gst_pad_push_event(pacer->srcpad, event);
+			gst_pad_pause_task(pacer->srcpad);
+			return ret;
+		case GST_EVENT_FLUSH_STOP:
+			ret = gst_pad_push_event(pacer->srcpad, event);
+			set_flushing(pacer, FALSE);
+			gst_pad_start_task(pacer->srcpad, (GstTaskFunction)gst_rtppacer_loop, pacer);
+			return ret;
+		default:
+			break;
+	}
+
+	// keep serialized events in order with the packets around them
+	if(GST_EVENT_IS_SERIALIZED(event))
+		return enqueue(pacer, GST_MINI_OBJECT_CAST(event), 0, FALSE) == GST_FLOW_OK;
+
+	return gst_pad_push_event(pacer->srcpad, event);
+}
+
+GstFlowReturn gst_rtppacer_chain(GstPad *pad, GstBuffer *buffer)
+{
+	GstRtpPacer *pacer = (GstRtpPacer *)GST_PAD_PARENT(pad);
+
+	return enqueue(pacer, GST_MINI_OBJECT_CAST(buffer), GST_BUFFER_SIZE(buffer), TRUE);
+}
+
+// each group of the list is one packet, and is queued on its own.  a
+//   single-buffer group goes through as a plain buffer, and anything
+//   bigger as a one-group list, so that nothing gets merged
+GstFlowReturn gst_rtppacer_chain_list(GstPad *pad, GstBufferList *list)
+{
+	GstRtpPacer *pacer = (GstRtpPacer *)GST_PAD_PARENT(pad);
+	GstBufferListIterator *it, *out_it;
+	GstBufferList *out;
+	GPtrArray *group;
+	GstBuffer *buf;
+	GstFlowReturn ret;
+	guint n;
+	int size;
+
+	group = g_ptr_array_new();
+	ret = GST_FLOW_OK;
+
+	it = gst_buffer_list_iterate(list);
+	while(ret == GST_FLOW_OK && gst_buffer_list_iterator_next_group(it))
+	{
+		g_ptr_array_set_size(group, 0);
+		size = 0;
+		while((buf = gst_buffer_list_iterator_next(it)) != NULL)
+		{
+			g_ptr_array_add(group, buf);
+			size += GST_BUFFER_SIZE(buf);
+		}
+
+		if(group->len == 0)
+			continue;
+
+		if(group->len == 1)
+		{
+			buf = gst_buffer_ref((GstBuffer *)g_ptr_array_index(group, 0));
+			ret = enqueue(pacer, GST_MINI_OBJECT_CAST(buf), size, TRUE);
+			continue;
+		}
+
+		out = gst_buffer_list_new();
+		out_it = gst_buffer_list_iterate(out);
+		gst_buffer_list_iterator_add_group(out_it);
+		for(n = 0; n < group->len; ++n)
+			gst_buffer_list_iterator_add(out_it, gst_buffer_ref((GstBuffer *)g_ptr_array_index(group, n)));
+		gst_buffer_list_iterator_free(out_it);
+
+		ret = enqueue(pacer, GST_MINI_OBJECT_CAST(out), size, TRUE);
+	}
+	gst_buffer_list_iterator_free(it);
+	g_ptr_array_free(group, TRUE);
+
+	gst_buffer_list_unref(list);
+	return ret;
+}
+
+void gst_rtppacer_set_property(GObject *obj, guint prop_id, const GValue *value, GParamSpec *pspec)
+{
+	GstRtpPacer *pacer = (GstRtpPacer *)obj;
+
+	switch(prop_id)
+	{
+		case PROP_BITRATE:
+			g_atomic_int_set(&pacer->bitrate, g_value_get_int(value));
+			break;
+		case PROP_BURST:
+			g_atomic_int_set(&pacer->burst, g_value_get_int(value));
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
+			break;
+	}
+}
+
+void gst_rtppacer_get_property(GObject *obj, guint prop_id, GValue *value, GParamSpec *pspec)
+{
+	GstRtpPacer *pacer = (GstRtpPacer *)obj;
+
+	switch(prop_id)
+	{
+		case PROP_BITRATE:
+			g_value_set_int(value, g_atomic_int_get(&pacer->bitrate));
+			break;
+		case PROP_BURST:
+			g_value_set_int(value, g_atomic_int_get(&pacer->burst));
+			break;
+		case PROP_QUEUE_DELAY:
+			g_value_set_int(value, g_atomic_int_get(&pacer->queue_delay));
+			break;
+		case PROP_MAX_QUEUE_DELAY:
+			g_value_set_int(value, g_atomic_int_get(&pacer->max_queue_delay));
+			break;
+		case PROP_DELAYED_PACKETS:
+			g_mutex_lock(pacer->lock);
+			g_value_set_uint64(value, pacer->delayed_packets);
+			g_mutex_unlock(pacer->lock);
+			break;
+		case PROP_DROPPED_PACKETS:
+			g_mutex_lock(pacer->lock);
+			g_value_set_uint64(value, pacer->dropped_packets);
+			g_mutex_unlock(pacer->lock);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
+			break;
+	}
+}
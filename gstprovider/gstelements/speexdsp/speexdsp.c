@@ -630,6 +630,9 @@ gst_speex_dsp_set_property (GObject * object,
   switch (prop_id)
   {
     case PROP_PROBE:
+      /* pairing explicitly takes us out of the global auto discovery, so
+       * that a probe showing up later doesn't steal us */
+      gst_speex_dsp_set_auto_attach (self, FALSE);
       if (G_LIKELY (g_value_get_object (value) != self->probe))
       {
         if (self->probe)
@@ -202,7 +202,7 @@ gst_speex_echo_probe_finalize (GObject * object)
 
   g_static_mutex_lock (&global_mutex);
   if (global_probe && global_probe == self) {
-    if (global_dsp) {
+    if (global_dsp && global_dsp->probe == self) {
       gst_speex_dsp_detach (GST_SPEEX_DSP (global_dsp));
       GST_DEBUG_OBJECT (self, "speexechoprobe detaching from globally discovered speexdsp");
     }
@@ -25,6 +25,7 @@
 #include <QMutex>
 #include <QWaitCondition>
 #include <QTime>
+#include <QTimer>
 #include <QtPlugin>
 #include <QIODevice>
 #include "devices.h"
@@ -232,10 +233,123 @@ signals:
 //   filled before they can be emptied, then we'll start dropping old
 //   items making room for new ones.  on a live transmission there's no
 //   sense in keeping ancient data around.  we just drop and move on.
-#define QUEUE_PACKET_MAX 25
+//   the app can pick its own cap per channel, up to QUEUE_PACKET_LIMIT.
+#define QUEUE_PACKET_MAX PRTP_QUEUE_DEFAULT
+#define QUEUE_PACKET_LIMIT PRTP_QUEUE_LIMIT
+
+// don't wake the main thread more often than this (in ms), for performance
+//   reasons, unless at least WAKE_PACKET_MIN packets are waiting
+#define WAKE_INTERVAL 10
+#define WAKE_PACKET_MIN 8
+
+// bounded queue of packets that any thread may push to, based on Dmitry
+//   Vyukov's bounded mpmc queue.  each cell carries a sequence number that
+//   says whether it is ready to be written or read for a given position,
+//   so pushing and popping only ever take a compare-and-exchange on the
+//   position counter.  it is multi-consumer as well, which lets a pusher
+//   that finds the queue full make room by popping the oldest packet
+class GstRtpPacketRing
+{
+public:
+	GstRtpPacketRing() :
+		head(0),
+		tail(0)
+	{
+		for(int n = 0; n < QUEUE_PACKET_LIMIT; ++n)
+			cells[n].seq = n;
+	}
+
+	// returns false if full
+	bool tryPush(const PRtpPacket &packet)
+	{
+		Cell *cell;
+		gint pos = g_atomic_int_get(&head);
+		while(1)
+		{
+			cell = &cells[pos & (QUEUE_PACKET_LIMIT - 1)];
+			gint diff = (gint)((guint)g_atomic_int_get(&cell->seq) - (guint)pos);
+			if(diff == 0)
+			{
+				if(g_atomic_int_compare_and_exchange(&head, pos, (gint)((guint)pos + 1)))
+					break;
+			}
+			else if(diff < 0)
+				return false;
+
+			pos = g_atomic_int_get(&head);
+		}
+
+		cell->packet = packet;
+		g_atomic_int_set(&cell->seq, (gint)((guint)pos + 1));
+		return true;
+	}
+
+	// returns false if empty
+	bool tryPop(PRtpPacket *packet)
+	{
+		Cell *cell;
+		gint pos = g_atomic_int_get(&tail);
+		while(1)
+		{
+			cell = &cells[pos & (QUEUE_PACKET_LIMIT - 1)];
+			gint diff = (gint)((guint)g_atomic_int_get(&cell->seq) - ((guint)pos + 1));
+			if(diff == 0)
+			{
+				if(g_atomic_int_compare_and_exchange(&tail, pos, (gint)((guint)pos + 1)))
+					break;
+			}
+			else if(diff < 0)
+				return false;
+
+			pos = g_atomic_int_get(&tail);
+		}
+
+		*packet = cell->packet;
+		cell->packet = PRtpPacket();
+		g_atomic_int_set(&cell->seq, (gint)((guint)pos + QUEUE_PACKET_LIMIT));
+		return true;
+	}
+
+	// if the queue already holds max packets (or is full), bump off the
+	//   oldest to make room.  returns the number of packets dropped
+	int push(const PRtpPacket &packet, int max)
+	{
+		PRtpPacket old;
+		int dropped = 0;
+		while(count() >= max && tryPop(&old))
+			++dropped;
+		while(!tryPush(packet))
+		{
+			// the consumer may have just made room, or be in the middle
+			//   of it.  only evict if the queue is still full
+			if(count() < QUEUE_PACKET_LIMIT)
+				continue;
+
+			if(tryPop(&old))
+				++dropped;
+		}
+		return dropped;
+	}
+
+	// approximate, if other threads are pushing or popping
+	int count()
+	{
+		int n = (int)((guint)g_atomic_int_get(&head) - (guint)g_atomic_int_get(&tail));
+		return qBound(0, n, QUEUE_PACKET_LIMIT);
+	}
 
-// don't wake the main thread more often than this, for performance reasons
-#define WAKE_PACKET_MIN 40
+private:
+	class Cell
+	{
+	public:
+		volatile gint seq;
+		PRtpPacket packet;
+	};
+
+	Cell cells[QUEUE_PACKET_LIMIT];
+	volatile gint head;
+	volatile gint tail;
+};
 
 class GstRtpSessionContext;
 
@@ -245,23 +359,58 @@ class GstRtpChannel : public QObject, public RtpChannelContext
 	Q_INTERFACES(PsiMedia::RtpChannelContext)
 
 public:
-	bool enabled;
-	QMutex m;
+	volatile gint enabled;
 	GstRtpSessionContext *session;
 	QList<PRtpPacket> in;
 
-	//QTime wake_time;
-	bool wake_pending;
-	QList<PRtpPacket> pending_in;
-
-	int written_pending;
+	// packets are handed over from the session without locking.  the
+	//   flags make sure that at most one wakeup is in flight, plus one
+	//   more if WAKE_PACKET_MIN packets pile up before it is handled
+	GstRtpPacketRing pending_in;
+	volatile gint wake_pending;
+	volatile gint wake_urgent;
+	QTime wake_time;
+	QTimer *wake_timer;
+
+	// if set, packets skip the queue.  the mutex is held while
+	//   delivering, so that the sink can't be removed mid-call
+	QMutex sink_mutex;
+	PRtpPacketSink *sink;
+	volatile gint has_sink;
+
+	// queue limit, and drop counters.  the session thread counts the
+	//   drops it makes while pushing, and we count the ones we make when
+	//   the app isn't reading.  these are reported as one total
+	volatile gint queue_max;
+	volatile gint push_dropped;
+	int push_dropped_reported;
+	int read_dropped;
+	int high_watermark; // -1 = default
+	bool above_high_watermark;
+
+	volatile gint written_pending;
 
 	GstRtpChannel() :
 		QObject(),
-		enabled(false),
-		wake_pending(false),
+		enabled(0),
+		wake_pending(0),
+		wake_urgent(0),
+		sink(0),
+		has_sink(0),
+		queue_max(QUEUE_PACKET_MAX),
+		push_dropped(0),
+		push_dropped_reported(0),
+		read_dropped(0),
+		high_watermark(-1),
+		above_high_watermark(false),
 		written_pending(0)
 	{
+		wake_time.start();
+
+		// child, so that it follows us across threads
+		wake_timer = new QTimer(this);
+		wake_timer->setSingleShot(true);
+		connect(wake_timer, SIGNAL(timeout()), SLOT(wake_timeout()));
 	}
 
 	virtual QObject *qobject()
@@ -271,8 +420,7 @@ public:
 
 	virtual void setEnabled(bool b)
 	{
-		QMutexLocker locker(&m);
-		enabled = b;
+		g_atomic_int_set(&enabled, b ? 1 : 0);
 	}
 
 	virtual int packetsAvailable() const
@@ -282,74 +430,271 @@ public:
 
 	virtual PRtpPacket read()
 	{
-		return in.takeFirst();
+		PRtpPacket rtp = in.takeFirst();
+		check_high_watermark();
+		return rtp;
+	}
+
+	virtual QList<PRtpPacket> readBatch(int max)
+	{
+		QList<PRtpPacket> out;
+		if(max < 0 || max >= in.count())
+		{
+			// implicitly shared, so this doesn't copy
+			out = in;
+			in.clear();
+		}
+		else
+		{
+			out = in.mid(0, max);
+			in.erase(in.begin(), in.begin() + max);
+		}
+		check_high_watermark();
+		return out;
+	}
+
+	virtual void setQueueSize(int packets)
+	{
+		g_atomic_int_set(&queue_max, qBound(1, packets, QUEUE_PACKET_LIMIT));
+		trim();
+		check_high_watermark();
+	}
+
+	virtual int queueSize()
+	{
+		return g_atomic_int_get(&queue_max);
+	}
+
+	virtual void setHighWatermark(int packets)
+	{
+		high_watermark = packets;
+		check_high_watermark();
+	}
+
+	virtual int packetsDropped()
+	{
+		return g_atomic_int_get(&push_dropped) + read_dropped;
 	}
 
 	virtual void write(const PRtpPacket &rtp)
 	{
-		m.lock();
-		if(!enabled)
+		if(!g_atomic_int_get(&enabled))
 			return;
-		m.unlock();
 
 		receiver_push_packet_for_write(rtp);
-		++written_pending;
+		written(1);
+	}
 
-		// only queue one call per eventloop pass
-		if(written_pending == 1)
-			QMetaObject::invokeMethod(this, "processOut", Qt::QueuedConnection);
+	virtual void writeBatch(const QList<PRtpPacket> &rtps)
+	{
+		if(rtps.isEmpty() || !g_atomic_int_get(&enabled))
+			return;
+
+		receiver_push_packets_for_write(rtps);
+		written(rtps.count());
+	}
+
+	virtual void setPacketSink(PRtpPacketSink *_sink)
+	{
+		QMutexLocker locker(&sink_mutex);
+		sink = _sink;
+		g_atomic_int_set(&has_sink, sink ? 1 : 0);
 	}
 
 	// session calls this, which may be in another thread
 	void push_packet_for_read(const PRtpPacket &rtp)
 	{
-		QMutexLocker locker(&m);
-		if(!enabled)
+		if(!g_atomic_int_get(&enabled))
 			return;
 
-		// if the queue is full, bump off the oldest to make room
-		if(pending_in.count() >= QUEUE_PACKET_MAX)
-			pending_in.removeFirst();
+		if(g_atomic_int_get(&has_sink))
+		{
+			QMutexLocker locker(&sink_mutex);
+			if(sink)
+			{
+				sink->packetReady(rtp);
+				return;
+			}
+		}
 
-		pending_in += rtp;
+		int dropped = pending_in.push(rtp, g_atomic_int_get(&queue_max));
+		if(dropped > 0)
+			g_atomic_int_add(&push_dropped, dropped);
+		wake();
+	}
 
-		// TODO: use WAKE_PACKET_MIN and wake_time ?
+	// same as above, but for a run of packets with at most one wakeup
+	void push_packets_for_read(const QList<PRtpPacket> &rtps)
+	{
+		if(!g_atomic_int_get(&enabled) || rtps.isEmpty())
+			return;
 
-		if(!wake_pending)
+		if(g_atomic_int_get(&has_sink))
 		{
-			wake_pending = true;
-			QMetaObject::invokeMethod(this, "processIn", Qt::QueuedConnection);
+			QMutexLocker locker(&sink_mutex);
+			if(sink)
+			{
+				foreach(const PRtpPacket &rtp, rtps)
+					sink->packetReady(rtp);
+				return;
+			}
 		}
+
+		int max = g_atomic_int_get(&queue_max);
+		int dropped = 0;
+		foreach(const PRtpPacket &rtp, rtps)
+			dropped += pending_in.push(rtp, max);
+		if(dropped > 0)
+			g_atomic_int_add(&push_dropped, dropped);
+		wake();
 	}
 
 signals:
 	void readyRead();
 	void packetsWritten(int count);
+	void packetsDropped(int count);
+	void highWatermark(int queued);
 
 private slots:
 	void processIn()
 	{
-		int oldcount = in.count();
+		// if we delivered only a moment ago, hold off until the
+		//   interval is up, unless enough packets have piled up
+		int elapsed = wake_time.elapsed();
+		if(pending_in.count() < wake_packet_min() && elapsed >= 0 && elapsed < WAKE_INTERVAL)
+		{
+			if(!wake_timer->isActive())
+				wake_timer->start(WAKE_INTERVAL - elapsed);
+			return;
+		}
 
-		m.lock();
-		wake_pending = false;
-		in += pending_in;
-		pending_in.clear();
-		m.unlock();
+		deliver();
+	}
 
-		if(in.count() > oldcount)
-			emit readyRead();
+	void wake_timeout()
+	{
+		deliver();
 	}
 
 	void processOut()
 	{
-		int count = written_pending;
-		written_pending = 0;
+		int count;
+		do
+		{
+			count = g_atomic_int_get(&written_pending);
+		} while(!g_atomic_int_compare_and_exchange(&written_pending, count, 0));
+
 		emit packetsWritten(count);
 	}
 
 private:
+	// note: this is executed from a different thread
+	void wake()
+	{
+		if(g_atomic_int_compare_and_exchange(&wake_pending, 0, 1))
+			QMetaObject::invokeMethod(this, "processIn", Qt::QueuedConnection);
+		else if(pending_in.count() >= wake_packet_min() && g_atomic_int_compare_and_exchange(&wake_urgent, 0, 1))
+			QMetaObject::invokeMethod(this, "processIn", Qt::QueuedConnection);
+	}
+
+	void deliver()
+	{
+		wake_timer->stop();
+		wake_time.start();
+
+		// clear the flags before draining, so that anything pushed
+		//   after this point is sure to cause another wakeup
+		g_atomic_int_set(&wake_urgent, 0);
+		g_atomic_int_set(&wake_pending, 0);
+
+		int oldcount = in.count();
+
+		PRtpPacket rtp;
+		while(pending_in.tryPop(&rtp))
+			in += rtp;
+
+		bool added = (in.count() > oldcount);
+
+		// the app isn't keeping up?
+		int trimmed = trim();
+
+		int pushed = g_atomic_int_get(&push_dropped);
+		int dropped = pushed - push_dropped_reported + trimmed;
+		push_dropped_reported = pushed;
+
+		// guard against being deleted during the signals
+		QPointer<QObject> self = this;
+
+		if(dropped > 0)
+		{
+			emit packetsDropped(dropped);
+			if(!self)
+				return;
+		}
+
+		if(added)
+		{
+			check_high_watermark();
+			if(!self)
+				return;
+
+			emit readyRead();
+		}
+	}
+
+	int wake_packet_min()
+	{
+		return qMin(WAKE_PACKET_MIN, (int)g_atomic_int_get(&queue_max));
+	}
+
+	// drop the oldest unread packets beyond the queue size
+	int trim()
+	{
+		int max = g_atomic_int_get(&queue_max);
+		int count = 0;
+		while(in.count() > max)
+		{
+			in.removeFirst();
+			++count;
+		}
+		read_dropped += count;
+		return count;
+	}
+
+	// highWatermark is emitted once each time the read queue fills up to
+	//   the mark, and then not again until it has gone back below it
+	void check_high_watermark()
+	{
+		int mark = high_watermark;
+		if(mark < 0)
+			mark = qMax(1, g_atomic_int_get(&queue_max) * 3 / 4);
+
+		if(mark == 0 || in.count() < mark)
+		{
+			above_high_watermark = false;
+			return;
+		}
+
+		if(!above_high_watermark)
+		{
+			above_high_watermark = true;
+			emit highWatermark(in.count());
+		}
+	}
+
+	// note: this may be executed from a different thread, if the app
+	//   writes from a packet sink
+	void written(int count)
+	{
+		bool wasZero = (g_atomic_int_exchange_and_add(&written_pending, count) == 0);
+
+		// only queue one call per eventloop pass
+		if(wasZero)
+			QMetaObject::invokeMethod(this, "processOut", Qt::QueuedConnection);
+	}
+
 	void receiver_push_packet_for_write(const PRtpPacket &rtp);
+	void receiver_push_packets_for_write(const QList<PRtpPacket> &rtps);
 };
 
 //----------------------------------------------------------------------------
@@ -494,6 +839,7 @@ class GstRtpSessionContext : public QObject, public RtpSessionContext
 	Q_INTERFACES(PsiMedia::RtpSessionContext)
 
 public:
+	GstThreadPool *pool;
 	GstThread *gstThread;
 
 	RwControlLocal *control;
@@ -517,9 +863,10 @@ public:
 	QMutex write_mutex;
 	bool allow_writes;
 
-	GstRtpSessionContext(GstThread *_gstThread, QObject *parent = 0) :
+	GstRtpSessionContext(GstThreadPool *_pool, QObject *parent = 0) :
 		QObject(parent),
-		gstThread(_gstThread),
+		pool(_pool),
+		gstThread(_pool->acquire()),
 		control(0),
 		isStarted(false),
 		isStopping(false),
@@ -547,6 +894,7 @@ public:
 	~GstRtpSessionContext()
 	{
 		cleanup();
+		pool->release(gstThread);
 	}
 
 	virtual QObject *qobject()
@@ -726,6 +1074,8 @@ public:
 		control->app = this;
 		control->cb_rtpAudioOut = cb_control_rtpAudioOut;
 		control->cb_rtpVideoOut = cb_control_rtpVideoOut;
+		control->cb_rtpAudioOutBatch = cb_control_rtpAudioOutBatch;
+		control->cb_rtpVideoOutBatch = cb_control_rtpVideoOutBatch;
 		control->cb_recordData = cb_control_recordData;
 
 		allow_writes = true;
@@ -876,6 +1226,19 @@ public:
 			control->rtpVideoIn(rtp);
 	}
 
+	// channel calls this, which may be in another thread
+	void push_packets_for_write(GstRtpChannel *from, const QList<PRtpPacket> &rtps)
+	{
+		QMutexLocker locker(&write_mutex);
+		if(!allow_writes || !control)
+			return;
+
+		if(from == &audioRtp)
+			control->rtpAudioIn(rtps);
+		else if(from == &videoRtp)
+			control->rtpVideoIn(rtps);
+	}
+
 signals:
 	void started();
 	void preferencesUpdated();
@@ -973,6 +1336,16 @@ private:
 		((GstRtpSessionContext *)app)->control_rtpVideoOut(packet);
 	}
 
+	static void cb_control_rtpAudioOutBatch(const QList<PRtpPacket> &packets, void *app)
+	{
+		((GstRtpSessionContext *)app)->control_rtpAudioOutBatch(packets);
+	}
+
+	static void cb_control_rtpVideoOutBatch(const QList<PRtpPacket> &packets, void *app)
+	{
+		((GstRtpSessionContext *)app)->control_rtpVideoOutBatch(packets);
+	}
+
 	static void cb_control_recordData(const QByteArray &packet, void *app)
 	{
 		((GstRtpSessionContext *)app)->control_recordData(packet);
@@ -990,6 +1363,18 @@ private:
 		videoRtp.push_packet_for_read(packet);
 	}
 
+	// note: this is executed from a different thread
+	void control_rtpAudioOutBatch(const QList<PRtpPacket> &packets)
+	{
+		audioRtp.push_packets_for_read(packets);
+	}
+
+	// note: this is executed from a different thread
+	void control_rtpVideoOutBatch(const QList<PRtpPacket> &packets)
+	{
+		videoRtp.push_packets_for_read(packets);
+	}
+
 	// note: this is executed from a different thread
 	void control_recordData(const QByteArray &packet)
 	{
@@ -1003,6 +1388,12 @@ void GstRtpChannel::receiver_push_packet_for_write(const PRtpPacket &rtp)
 		session->push_packet_for_write(this, rtp);
 }
 
+void GstRtpChannel::receiver_push_packets_for_write(const QList<PRtpPacket> &rtps)
+{
+	if(session)
+		session->push_packets_for_write(this, rtps);
+}
+
 //----------------------------------------------------------------------------
 // GstProvider
 //----------------------------------------------------------------------------
@@ -1012,10 +1403,10 @@ class GstProvider : public QObject, public Provider
 	Q_INTERFACES(PsiMedia::Provider)
 
 public:
-	GstThread *thread;
+	GstThreadPool *pool;
 
 	GstProvider() :
-		thread(0)
+		pool(0)
 	{
 	}
 
@@ -1026,11 +1417,11 @@ public:
 
 	virtual bool init(const QString &resourcePath)
 	{
-		thread = new GstThread(this);
-		if(!thread->start(resourcePath))
+		pool = new GstThreadPool;
+		if(!pool->start(resourcePath))
 		{
-			delete thread;
-			thread = 0;
+			delete pool;
+			pool = 0;
 			return false;
 		}
 
@@ -1039,7 +1430,7 @@ public:
 
 	~GstProvider()
 	{
-		delete thread;
+		delete pool;
 	}
 
 	virtual QString creditName()
@@ -1055,18 +1446,18 @@ public:
 		"more information, see http://www.gstreamer.net/\n\n"
 		"If you enjoy this software, please give the GStreamer "
 		"people a million dollars."
-		).arg(thread->gstVersion());
+		).arg(pool->gstVersion());
 		return str;
 	}
 
 	virtual FeaturesContext *createFeatures()
 	{
-		return new GstFeaturesContext(thread);
+		return new GstFeaturesContext(pool->primary());
 	}
 
 	virtual RtpSessionContext *createRtpSession()
 	{
-		return new GstRtpSessionContext(thread);
+		return new GstRtpSessionContext(pool);
 	}
 };
 
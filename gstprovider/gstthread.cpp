@@ -29,10 +29,21 @@
 #include <QApplication>
 #include <QStyle>
 #include <QIcon>
+#include <QHash>
 #include <gst/gst.h>
 #include "gstcustomelements/gstcustomelements.h"
 #include "gstelements/static/gstelements.h"
 
+#if defined(Q_OS_WIN)
+# include <windows.h>
+#elif defined(Q_OS_LINUX)
+# include <pthread.h>
+# include <sched.h>
+# include <string.h>
+#endif
+
+//#define PLACEMENT_DEBUG
+
 namespace PsiMedia {
 
 //----------------------------------------------------------------------------
@@ -281,6 +292,8 @@ class GstThread::Private
 {
 public:
 	QString pluginPath;
+	bool initGst;
+	int index;
 	GstSession *gstSession;
 	bool success;
 	GMainContext *mainContext;
@@ -289,6 +302,8 @@ public:
 	QWaitCondition w;
 
 	Private() :
+		initGst(true),
+		index(0),
 		gstSession(0),
 		success(false),
 		mainContext(0),
@@ -337,6 +352,16 @@ bool GstThread::start(const QString &pluginPath)
 {
 	QMutexLocker locker(&d->m);
 	d->pluginPath = pluginPath;
+	d->initGst = true;
+	QThread::start();
+	d->w.wait(&d->m);
+	return d->success;
+}
+
+bool GstThread::startEventLoop()
+{
+	QMutexLocker locker(&d->m);
+	d->initGst = false;
 	QThread::start();
 	d->w.wait(&d->m);
 	return d->success;
@@ -358,7 +383,7 @@ void GstThread::stop()
 QString GstThread::gstVersion() const
 {
 	QMutexLocker locker(&d->m);
-	return d->gstSession->version;
+	return d->gstSession ? d->gstSession->version : QString();
 }
 
 GMainContext *GstThread::mainContext()
@@ -367,6 +392,11 @@ GMainContext *GstThread::mainContext()
 	return d->mainContext;
 }
 
+void GstThread::setIndex(int index)
+{
+	d->index = index;
+}
+
 void GstThread::run()
 {
 	//printf("GStreamer thread started\n");
@@ -374,10 +404,11 @@ void GstThread::run()
 	// this will be unlocked as soon as the mainloop runs
 	d->m.lock();
 
-	d->gstSession = new GstSession(d->pluginPath);
+	if(d->initGst)
+		d->gstSession = new GstSession(d->pluginPath);
 
 	// report error
-	if(!d->gstSession->success)
+	if(d->gstSession && !d->gstSession->success)
 	{
 		d->success = false;
 		delete d->gstSession;
@@ -392,6 +423,8 @@ void GstThread::run()
 
 	//printf("Using GStreamer version %s\n", qPrintable(d->gstSession->version));
 
+	placeCurrentThread(PlaceControl, d->index);
+
 	d->mainContext = g_main_context_new();
 	d->mainLoop = g_main_loop_new(d->mainContext, FALSE);
 
@@ -403,6 +436,12 @@ void GstThread::run()
 	// kick off the event loop
 	g_main_loop_run(d->mainLoop);
 
+	// objects are handed to this thread to be deleted without anyone
+	//   waiting on it, so let any such pending work finish
+	while(g_main_context_iteration(d->mainContext, FALSE))
+	{
+	}
+
 	QMutexLocker locker(&d->m);
 	g_main_loop_unref(d->mainLoop);
 	d->mainLoop = 0;
@@ -415,4 +454,276 @@ void GstThread::run()
 	//printf("GStreamer thread completed\n");
 }
 
+//----------------------------------------------------------------------------
+// GstThreadPool
+//----------------------------------------------------------------------------
+// more than this is unlikely to help, as the threads mostly just
+//   supervise pipelines that do their work on their own threads
+#define POOL_SIZE_MAX 16
+
+GstThreadPool::GstThreadPool() :
+	size(1)
+{
+}
+
+GstThreadPool::~GstThreadPool()
+{
+	// the first thread owns the gstreamer session, so it goes last
+	while(!threads.isEmpty())
+		delete threads.takeLast();
+}
+
+bool GstThreadPool::start(const QString &pluginPath, int _size)
+{
+	size = _size;
+	if(size < 1)
+	{
+		QByteArray val = qgetenv("PSI_GST_THREADS");
+		if(!val.isEmpty())
+			size = val.toInt();
+		else
+			size = QThread::idealThreadCount();
+	}
+	size = qBound(1, size, POOL_SIZE_MAX);
+
+	GstThread *thread = new GstThread;
+	if(!thread->start(pluginPath))
+	{
+		delete thread;
+		return false;
+	}
+
+	threads += thread;
+	loads += 0;
+	return true;
+}
+
+GstThread *GstThreadPool::primary()
+{
+	return threads.first();
+}
+
+QString GstThreadPool::gstVersion() const
+{
+	return threads.first()->gstVersion();
+}
+
+GstThread *GstThreadPool::acquire()
+{
+	int at = 0;
+	for(int n = 1; n < loads.count(); ++n)
+	{
+		if(loads[n] < loads[at])
+			at = n;
+	}
+
+	// everyone is busy.  add a thread if we can, otherwise share
+	if(loads[at] > 0 && threads.count() < size)
+	{
+		GstThread *thread = new GstThread;
+		thread->setIndex(threads.count());
+		if(thread->startEventLoop())
+		{
+			threads += thread;
+			loads += 0;
+			at = threads.count() - 1;
+		}
+		else
+			delete thread;
+	}
+
+	++loads[at];
+	return threads[at];
+}
+
+void GstThreadPool::release(GstThread *thread)
+{
+	int at = threads.indexOf(thread);
+	if(at != -1)
+		--loads[at];
+}
+
+//----------------------------------------------------------------------------
+// Thread placement
+//----------------------------------------------------------------------------
+static QList<int> get_cpu_list(const char *var)
+{
+	QList<int> out;
+	QString val = QString::fromLatin1(qgetenv(var));
+	foreach(const QString &part, val.split(',', QString::SkipEmptyParts))
+	{
+		int first, last;
+		bool ok1, ok2;
+		int at = part.indexOf('-');
+		if(at != -1)
+		{
+			first = part.left(at).trimmed().toInt(&ok1);
+			last = part.mid(at + 1).trimmed().toInt(&ok2);
+		}
+		else
+		{
+			first = part.trimmed().toInt(&ok1);
+			last = first;
+			ok2 = true;
+		}
+
+		if(!ok1 || !ok2 || first < 0 || last < first)
+			continue;
+
+		for(int n = first; n <= last; ++n)
+		{
+			if(!out.contains(n))
+				out += n;
+		}
+	}
+	return out;
+}
+
+// the environment is only read once
+class CpuSets
+{
+public:
+	QList<int> control, audio, video;
+
+	CpuSets()
+	{
+		control = get_cpu_list("PSI_CPU_CONTROL");
+		audio = get_cpu_list("PSI_CPU_AUDIO");
+		video = get_cpu_list("PSI_CPU_VIDEO");
+	}
+};
+
+Q_GLOBAL_STATIC(CpuSets, cpu_sets)
+
+// the affinity that threads had before we placed them, so that pooled
+//   streaming threads can be put back when a task leaves them
+#if defined(Q_OS_LINUX)
+typedef cpu_set_t SavedAffinity;
+#elif defined(Q_OS_WIN)
+typedef DWORD_PTR SavedAffinity;
+#else
+typedef int SavedAffinity;
+#endif
+
+class SavedAffinities
+{
+public:
+	QMutex m;
+	QHash<Qt::HANDLE, SavedAffinity> threads;
+};
+
+Q_GLOBAL_STATIC(SavedAffinities, saved_affinities)
+
+static void save_affinity(const SavedAffinity &old)
+{
+	SavedAffinities *saved = saved_affinities();
+	QMutexLocker locker(&saved->m);
+
+	// if we place the same thread twice, the first one is the original
+	Qt::HANDLE self = QThread::currentThreadId();
+	if(!saved->threads.contains(self))
+		saved->threads.insert(self, old);
+}
+
+void placeCurrentThread(ThreadPlacement type, int index)
+{
+	const char *var;
+	QList<int> cpus;
+	if(type == PlaceControl)
+	{
+		var = "PSI_CPU_CONTROL";
+		cpus = cpu_sets()->control;
+	}
+	else if(type == PlaceAudio)
+	{
+		var = "PSI_CPU_AUDIO";
+		cpus = cpu_sets()->audio;
+	}
+	else
+	{
+		var = "PSI_CPU_VIDEO";
+		cpus = cpu_sets()->video;
+	}
+
+	if(cpus.isEmpty())
+		return;
+
+	if(index >= 0)
+	{
+		int cpu = cpus[index % cpus.count()];
+		cpus.clear();
+		cpus += cpu;
+	}
+
+#if defined(Q_OS_LINUX)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	foreach(int cpu, cpus)
+	{
+		if(cpu < CPU_SETSIZE)
+			CPU_SET(cpu, &set);
+	}
+
+	cpu_set_t old;
+	CPU_ZERO(&old);
+	if(pthread_getaffinity_np(pthread_self(), sizeof(old), &old) != 0)
+		return;
+
+	int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if(ret == 0)
+		save_affinity(old);
+#ifdef PLACEMENT_DEBUG
+	else
+		printf("unable to apply %s (%s)\n", var, strerror(ret));
+#endif
+#elif defined(Q_OS_WIN)
+	DWORD_PTR mask = 0;
+	foreach(int cpu, cpus)
+	{
+		if(cpu < (int)sizeof(DWORD_PTR) * 8)
+			mask |= (DWORD_PTR)1 << cpu;
+	}
+
+	DWORD_PTR old = 0;
+	if(mask)
+		old = SetThreadAffinityMask(GetCurrentThread(), mask);
+	if(old)
+		save_affinity(old);
+#ifdef PLACEMENT_DEBUG
+	else
+		printf("unable to apply %s (error %d)\n", var, (int)GetLastError());
+#endif
+#else
+	// no affinity api here (e.g. mac)
+	Q_UNUSED(var);
+#endif
+}
+
+void restoreCurrentThread()
+{
+	SavedAffinity old;
+	{
+		SavedAffinities *saved = saved_affinities();
+		QMutexLocker locker(&saved->m);
+		Qt::HANDLE self = QThread::currentThreadId();
+		if(!saved->threads.contains(self))
+			return;
+		old = saved->threads.take(self);
+	}
+
+#if defined(Q_OS_LINUX)
+	int ret = pthread_setaffinity_np(pthread_self(), sizeof(old), &old);
+#ifdef PLACEMENT_DEBUG
+	if(ret != 0)
+		printf("unable to restore thread affinity (%s)\n", strerror(ret));
+#else
+	Q_UNUSED(ret);
+#endif
+#elif defined(Q_OS_WIN)
+	SetThreadAffinityMask(GetCurrentThread(), old);
+#else
+	Q_UNUSED(old);
+#endif
+}
+
 }
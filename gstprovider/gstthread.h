@@ -22,6 +22,7 @@
 #define PSI_GSTTHREAD_H
 
 #include <QThread>
+#include <QList>
 #include <glib.h>
 
 namespace PsiMedia {
@@ -42,9 +43,16 @@ public:
 	bool start(const QString &pluginPath);
 	void stop();
 
+	// like start(), but only sets up the eventloop.  for extra threads
+	//   once gstreamer has been initialized by another GstThread
+	bool startEventLoop();
+
 	QString gstVersion() const;
 	GMainContext *mainContext();
 
+	// position among its siblings, for placement.  set before starting
+	void setIndex(int index);
+
 protected:
 	virtual void run();
 
@@ -53,6 +61,56 @@ private:
 	Private *d;
 };
 
+// spreads sessions over several GstThreads, so that one session's slow
+//   state change doesn't hold up the others.  the first thread initializes
+//   gstreamer, and more are started as sessions need them, up to the pool
+//   size.  main thread only.
+class GstThreadPool
+{
+public:
+	GstThreadPool();
+	~GstThreadPool();
+
+	// size -1 means the PSI_GST_THREADS environment variable, or else
+	//   the number of cores
+	bool start(const QString &pluginPath, int size = -1);
+
+	GstThread *primary();
+	QString gstVersion() const;
+
+	// the least loaded thread for a new session, starting another one
+	//   if all are busy.  balance with release()
+	GstThread *acquire();
+	void release(GstThread *thread);
+
+private:
+	int size;
+	QList<GstThread*> threads;
+	QList<int> loads;
+
+	Q_DISABLE_COPY(GstThreadPool);
+};
+
+// thread placement.  cpu sets are taken from the environment as lists
+//   such as "0-3,8": PSI_CPU_CONTROL for the GstThread eventloops, and
+//   PSI_CPU_AUDIO and PSI_CPU_VIDEO for pipeline streaming threads.  if
+//   index is given, the thread is pinned to just one cpu of the set,
+//   chosen in turn, so that GstThreads don't share a core.  an unset
+//   variable means no pinning.
+enum ThreadPlacement
+{
+	PlaceControl,
+	PlaceAudio,
+	PlaceVideo
+};
+
+// applies to the calling thread
+void placeCurrentThread(ThreadPlacement type, int index = -1);
+
+// puts the calling thread back on the cpus it had before
+//   placeCurrentThread(), if it was placed
+void restoreCurrentThread();
+
 }
 
 #endif
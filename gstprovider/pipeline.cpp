@@ -23,8 +23,22 @@
 #include <stdio.h>
 #include <QList>
 #include <QSet>
+#include <QHash>
+#include <QMutex>
+#include <QThread>
 #include <gst/gst.h>
 #include "devices.h"
+#include "gstthread.h"
+
+#ifdef Q_OS_WIN
+# include <windows.h>
+#else
+# include <errno.h>
+# include <pthread.h>
+# include <sched.h>
+# include <string.h>
+# include <sys/resource.h>
+#endif
 
 // FIXME: this file is heavily commented out and a mess, mainly because
 //   all of my attempts at a dynamic pipeline were futile.  someday we
@@ -40,6 +54,9 @@
 
 //#define USE_LIVEADDER
 
+// real-time priority for audio threads, if enabled with PSI_AUDIO_RT
+#define DEFAULT_AUDIO_RT_PRIORITY 10
+
 namespace PsiMedia {
 
 static int get_fixed_rate()
@@ -72,6 +89,156 @@ static int get_latency_time()
 		return DEFAULT_LATENCY;
 }
 
+// elements marked with these, and anything inside them, are on the audio
+//   or video path
+static const char *AUDIO_ELEMENT_KEY = "psimedia-audio";
+static const char *VIDEO_ELEMENT_KEY = "psimedia-video";
+
+// set once we learn that we aren't allowed to raise priorities, so that
+//   we don't keep trying (and complaining) for every thread
+static volatile gint audio_rt_denied = 0;
+
+static bool is_marked_element(GstObject *obj, const char *key)
+{
+	for(GstObject *i = obj; i; i = GST_OBJECT_PARENT(i))
+	{
+		if(g_object_get_data(G_OBJECT(i), key))
+			return true;
+	}
+	return false;
+}
+
+// what a raised thread had before, so that it can be put back when the
+//   task leaves it.  streaming threads come from a pool and get reused
+class SavedPriority
+{
+public:
+#ifdef Q_OS_WIN
+	int priority;
+#else
+	int policy;
+	struct sched_param param;
+#endif
+};
+
+class RaisedThreads
+{
+public:
+	QMutex m;
+	QHash<Qt::HANDLE, SavedPriority> threads;
+};
+
+Q_GLOBAL_STATIC(RaisedThreads, raised_threads)
+
+static void add_raised_thread(const SavedPriority &old)
+{
+	RaisedThreads *raised = raised_threads();
+	QMutexLocker locker(&raised->m);
+	Qt::HANDLE self = QThread::currentThreadId();
+	if(!raised->threads.contains(self))
+		raised->threads.insert(self, old);
+}
+
+// PSI_AUDIO_RT=fifo (or 1) or rr selects the scheduling policy, and
+//   PSI_AUDIO_RT_PRIORITY the priority.  this must be called from the
+//   thread to be raised
+static void raise_audio_thread(GstElement *owner)
+{
+	QString mode = QString::fromLatin1(qgetenv("PSI_AUDIO_RT")).toLower();
+	if(mode.isEmpty() || mode == "0" || g_atomic_int_get(&audio_rt_denied))
+		return;
+
+	SavedPriority old;
+
+#ifdef PIPELINE_DEBUG
+	gchar *name = gst_element_get_name(owner);
+#else
+	Q_UNUSED(owner);
+#endif
+
+#ifdef Q_OS_WIN
+	old.priority = GetThreadPriority(GetCurrentThread());
+	if(SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+	{
+		add_raised_thread(old);
+#ifdef PIPELINE_DEBUG
+		printf("audio thread of %s raised to time critical\n", name);
+#endif
+	}
+	else
+	{
+		g_atomic_int_set(&audio_rt_denied, 1);
+		qWarning("psimedia: unable to raise audio thread priority (error %d), leaving as is", (int)GetLastError());
+	}
+#else
+	if(pthread_getschedparam(pthread_self(), &old.policy, &old.param) != 0)
+		return;
+
+	int policy = (mode == "rr") ? SCHED_RR : SCHED_FIFO;
+
+	int prio = DEFAULT_AUDIO_RT_PRIORITY;
+	QString val = QString::fromLatin1(qgetenv("PSI_AUDIO_RT_PRIORITY"));
+	if(val.toInt() > 0)
+		prio = val.toInt();
+	prio = qBound(sched_get_priority_min(policy), prio, sched_get_priority_max(policy));
+
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = prio;
+	int ret = pthread_setschedparam(pthread_self(), policy, &param);
+
+#ifdef RLIMIT_RTPRIO
+	// unprivileged, we may still be allowed up to RLIMIT_RTPRIO
+	struct rlimit rl;
+	if(ret == EPERM && getrlimit(RLIMIT_RTPRIO, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur > 0 && (rlim_t)prio > rl.rlim_cur)
+	{
+		param.sched_priority = (int)rl.rlim_cur;
+		ret = pthread_setschedparam(pthread_self(), policy, &param);
+	}
+#endif
+
+	if(ret == 0)
+	{
+		add_raised_thread(old);
+#ifdef PIPELINE_DEBUG
+		printf("audio thread of %s raised to %s:%d\n", name, policy == SCHED_RR ? "SCHED_RR" : "SCHED_FIFO", param.sched_priority);
+#endif
+	}
+	else
+	{
+		g_atomic_int_set(&audio_rt_denied, 1);
+		qWarning("psimedia: unable to raise audio thread priority (%s), leaving as is", strerror(ret));
+	}
+#endif
+
+#ifdef PIPELINE_DEBUG
+	g_free(name);
+#endif
+}
+
+// puts the calling thread back to how it was before raise_audio_thread(),
+//   if it was raised
+static void restore_audio_thread()
+{
+	SavedPriority old;
+	{
+		RaisedThreads *raised = raised_threads();
+		QMutexLocker locker(&raised->m);
+		Qt::HANDLE self = QThread::currentThreadId();
+		if(!raised->threads.contains(self))
+			return;
+		old = raised->threads.take(self);
+	}
+
+#ifdef Q_OS_WIN
+	SetThreadPriority(GetCurrentThread(), old.priority);
+#else
+	int ret = pthread_setschedparam(pthread_self(), old.policy, &old.param);
+	if(ret != 0)
+		qWarning("psimedia: unable to restore audio thread priority (%s)", strerror(ret));
+#endif
+}
+
 static const char *type_to_str(PDevice::Type type)
 {
 	switch(type)
@@ -306,8 +473,23 @@ static GstElement *make_devicebin(const QString &id, PDevice::Type type, const Q
 //----------------------------------------------------------------------------
 // PipelineContext
 //----------------------------------------------------------------------------
-static GstElement *g_speexdsp = 0;
-static GstElement *g_speexprobe = 0;
+// each audio capture device gets its own speexdsp and each audio playback
+//   device its own speexechoprobe.  the pair belonging to a session is
+//   joined with PipelineDeviceContext::setEchoPlayback(), rather than by
+//   the elements discovering each other process-wide
+
+// devices are only shared among the users of one pipeline.  sessions
+//   have pipelines of their own, so concurrent sessions each open the
+//   device again, which fails for devices that can't be opened twice
+//   (e.g. alsa hw:).  this counts the openings across the process, in
+//   order to warn about it
+static QHash<QString, int> g_device_opens;
+static QMutex g_device_mutex;
+
+static QString device_key(PDevice::Type type, const QString &id)
+{
+	return QString::number((int)type) + ':' + id;
+}
 
 class PipelineDevice;
 
@@ -346,6 +528,13 @@ public:
 	GstElement *capsfilter;
 	GstElement *speexprobe;
 
+	// discontinuities seen at the device, for audio.  the capture side
+	//   flags these on overruns
+	GstPad *probe_pad;
+	gulong probe_id;
+	int probe_buffers; // streaming thread only
+	volatile gint glitches;
+
 	PipelineDevice(const QString &_id, PDevice::Type _type, PipelineDeviceContextPrivate *context) :
 		refs(0),
 		id(_id),
@@ -357,7 +546,11 @@ public:
 		audioconvert(0),
 		audioresample(0),
 		capsfilter(0),
-		speexprobe(0)
+		speexprobe(0),
+		probe_pad(0),
+		probe_id(0),
+		probe_buffers(0),
+		glitches(0)
 	{
 		pipeline = context->pipeline->element();
 
@@ -365,20 +558,35 @@ public:
 		if(!bin)
 			return;
 
+		g_device_mutex.lock();
+		int opens = ++g_device_opens[device_key(type, id)];
+		g_device_mutex.unlock();
+		if(opens > 1)
+			qWarning("psimedia: %s [%s] is already open in another session, this fails if the device can only be opened once", type_to_str(type), qPrintable(id));
+
+		if(type == PDevice::VideoIn)
+			PipelineContext::markVideoElement(bin);
+
+		if(type == PDevice::AudioIn || type == PDevice::AudioOut)
+		{
+			PipelineContext::markAudioElement(bin);
+
+			probe_pad = gst_element_get_static_pad(bin, type == PDevice::AudioIn ? "src" : "sink");
+			if(probe_pad)
+				probe_id = gst_pad_add_buffer_probe(probe_pad, G_CALLBACK(cb_buffer_probe), this);
+		}
+
 		// TODO: use context->opts.fps?
 
 		if(type == PDevice::AudioIn || type == PDevice::VideoIn)
 		{
-			if(type == PDevice::AudioIn && !g_speexdsp)
+			if(type == PDevice::AudioIn)
 			{
 				speexdsp = gst_element_factory_make("speexdsp", NULL);
-				if(speexdsp)
-				{
 #ifdef PIPELINE_DEBUG
+				if(speexdsp)
 					printf("using speexdsp\n");
 #endif
-					g_speexdsp = speexdsp;
-				}
 			}
 
 			if(speexdsp)
@@ -429,12 +637,11 @@ public:
 			g_object_set(G_OBJECT(capsfilter), "caps", caps, NULL);
 			gst_caps_unref(caps);
 
-			if(!g_speexprobe && QString::fromLatin1(qgetenv("PSI_NO_ECHO_CANCEL")) != "1")
+			if(QString::fromLatin1(qgetenv("PSI_NO_ECHO_CANCEL")) != "1")
 			{
 				speexprobe = gst_element_factory_make("speexechoprobe", NULL);
 				if(speexprobe) {
 					printf("using speexechoprobe\n");
-					g_speexprobe = speexprobe;
 					QString latency_tune = qgetenv("PSI_AUDIO_LTUNE");
 					if(!latency_tune.isEmpty())
 						g_object_set(G_OBJECT(speexprobe), "latency-tune", latency_tune.toInt(), NULL);
@@ -488,15 +695,28 @@ public:
 		if(!bin)
 			return;
 
+		g_device_mutex.lock();
+		QString key = device_key(type, id);
+		if(--g_device_opens[key] <= 0)
+			g_device_opens.remove(key);
+		g_device_mutex.unlock();
+
+		if(probe_pad)
+		{
+			gst_pad_remove_buffer_probe(probe_pad, probe_id);
+			gst_object_unref(GST_OBJECT(probe_pad));
+
+#ifdef PIPELINE_DEBUG
+			printf("%s: %d glitches\n", type_to_str(type), g_atomic_int_get(&glitches));
+#endif
+		}
+
 		if(type == PDevice::AudioIn || type == PDevice::VideoIn)
 		{
 			gst_bin_remove(GST_BIN(pipeline), bin);
 
 			if(speexdsp)
-			{
 				gst_bin_remove(GST_BIN(pipeline), speexdsp);
-				g_speexdsp = 0;
-			}
 
 			if(tee)
 				gst_bin_remove(GST_BIN(pipeline), tee);
@@ -536,7 +756,6 @@ public:
 				{
 					gst_element_get_state(speexprobe, NULL, NULL, GST_CLOCK_TIME_NONE);
 					gst_bin_remove(GST_BIN(pipeline), speexprobe);
-					g_speexprobe = 0;
 				}
 			}
 
@@ -556,6 +775,10 @@ public:
 			//   uses this queue element as if it were the actual
 			//   device
 			GstElement *queue = gst_element_factory_make("queue", NULL);
+			if(type == PDevice::AudioIn)
+				PipelineContext::markAudioElement(queue);
+			else
+				PipelineContext::markVideoElement(queue);
 			context->element = queue;
 			//gst_element_set_locked_state(queue, TRUE);
 			gst_bin_add(GST_BIN(pipeline), queue);
@@ -699,6 +922,18 @@ public:
 	{
 		// TODO: change video properties based on options
 	}
+
+	static gboolean cb_buffer_probe(GstPad *pad, GstBuffer *buf, gpointer data)
+	{
+		Q_UNUSED(pad);
+		PipelineDevice *self = (PipelineDevice *)data;
+
+		// the first buffer is always flagged
+		if(GST_BUFFER_IS_DISCONT(buf) && self->probe_buffers > 0)
+			g_atomic_int_inc(&self->glitches);
+		++self->probe_buffers;
+		return TRUE;
+	}
 };
 
 class PipelineContext::Private
@@ -712,6 +947,10 @@ public:
 		activated(false)
 	{
 		pipeline = gst_pipeline_new(NULL);
+
+		GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+		gst_bus_set_sync_handler(bus, cb_sync_message, this);
+		gst_object_unref(bus);
 	}
 
 	~Private()
@@ -740,6 +979,48 @@ public:
 			activated = false;
 		}
 	}
+
+	// note: this is executed from whichever thread posted the message
+	static GstBusSyncReply cb_sync_message(GstBus *bus, GstMessage *msg, gpointer data)
+	{
+		Q_UNUSED(bus);
+		Q_UNUSED(data);
+
+#if GST_CHECK_VERSION(0,10,24)
+		if(GST_MESSAGE_TYPE(msg) == GST_MESSAGE_STREAM_STATUS)
+		{
+			GstStreamStatusType type;
+			GstElement *owner;
+			gst_message_parse_stream_status(msg, &type, &owner);
+
+			// enter is posted by the streaming thread itself
+			if(type == GST_STREAM_STATUS_TYPE_ENTER)
+			{
+				if(is_marked_element(GST_OBJECT(owner), AUDIO_ELEMENT_KEY))
+				{
+					placeCurrentThread(PlaceAudio);
+					raise_audio_thread(owner);
+				}
+				else if(is_marked_element(GST_OBJECT(owner), VIDEO_ELEMENT_KEY))
+					placeCurrentThread(PlaceVideo);
+			}
+			// so is leave.  the thread goes back to the pool after
+			//   this, so undo whatever enter did
+			else if(type == GST_STREAM_STATUS_TYPE_LEAVE)
+			{
+				restore_audio_thread();
+				restoreCurrentThread();
+			}
+
+			// nobody reads these off the bus
+			return GST_BUS_DROP;
+		}
+#else
+		Q_UNUSED(msg);
+#endif
+
+		return GST_BUS_PASS;
+	}
 };
 
 PipelineContext::PipelineContext()
@@ -767,6 +1048,28 @@ GstElement *PipelineContext::element()
 	return d->pipeline;
 }
 
+void PipelineContext::markAudioElement(GstElement *element)
+{
+	g_object_set_data(G_OBJECT(element), AUDIO_ELEMENT_KEY, GINT_TO_POINTER(1));
+}
+
+void PipelineContext::markVideoElement(GstElement *element)
+{
+	g_object_set_data(G_OBJECT(element), VIDEO_ELEMENT_KEY, GINT_TO_POINTER(1));
+}
+
+int PipelineContext::raisedThreadCount()
+{
+	RaisedThreads *raised = raised_threads();
+	QMutexLocker locker(&raised->m);
+	return raised->threads.count();
+}
+
+bool PipelineContext::raiseDenied()
+{
+	return g_atomic_int_get(&audio_rt_denied) ? true : false;
+}
+
 //----------------------------------------------------------------------------
 // PipelineDeviceContext
 //----------------------------------------------------------------------------
@@ -865,4 +1168,14 @@ void PipelineDeviceContext::setOptions(const PipelineDeviceOptions &opts)
 	d->device->update();
 }
 
+void PipelineDeviceContext::setEchoPlayback(PipelineDeviceContext *out)
+{
+	GstElement *speexdsp = d->device->speexdsp;
+	if(!speexdsp)
+		return;
+
+	GstElement *speexprobe = out ? out->d->device->speexprobe : 0;
+	g_object_set(G_OBJECT(speexdsp), "probe", speexprobe, NULL);
+}
+
 }
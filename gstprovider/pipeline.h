@@ -44,6 +44,20 @@ public:
 
 	GstElement *element();
 
+	// streaming threads owned by the element, or by anything inside of
+	//   it, are treated as audio threads.  with PSI_AUDIO_RT set, these
+	//   are given real-time priority when they start
+	static void markAudioElement(GstElement *element);
+
+	// same for video, which only matters for placement.  see
+	//   placeCurrentThread()
+	static void markVideoElement(GstElement *element);
+
+	// audio threads currently running at raised priority, and whether
+	//   a raise has been refused (after which no more are tried)
+	static int raisedThreadCount();
+	static bool raiseDenied();
+
 private:
 	friend class PipelineDeviceContext;
 	friend class PipelineDeviceContextPrivate;
@@ -97,6 +111,11 @@ public:
 	GstElement *element();
 	void setOptions(const PipelineDeviceOptions &opts);
 
+	// for AudioIn: cancel the echo of what the AudioOut device out plays,
+	//   or of nothing if out is 0.  the two may be in different pipelines.
+	//   unpair before out is deleted
+	void setEchoPlayback(PipelineDeviceContext *out);
+
 private:
 	PipelineDeviceContext();
 
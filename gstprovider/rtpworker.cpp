@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <QStringList>
 #include <QTime>
+#include <QVarLengthArray>
 #include "devices.h"
 #include "payloadinfo.h"
 #include "pipeline.h"
@@ -133,6 +134,403 @@ public:
 	}
 };
 
+// number of consecutive packets from a new ssrc before we switch to it
+#define SSRC_SWITCH_PACKETS 4
+
+// cheap sanity checks on incoming rtp, so that junk is discarded before
+//   it costs anything in the streaming thread
+class RtpInFilter
+{
+public:
+	bool anyPayloadType;
+	bool payloadTypes[128];
+	bool haveSsrc;
+	quint32 ssrc;
+	quint32 newSsrc;
+	int newSsrcCount;
+
+	int badHeader;
+	int badPayloadType;
+	int badSsrc;
+
+	RtpInFilter() :
+		badHeader(0),
+		badPayloadType(0),
+		badSsrc(0)
+	{
+		reset();
+	}
+
+	// accept any payload type until told otherwise
+	void reset()
+	{
+		anyPayloadType = true;
+		for(int n = 0; n < 128; ++n)
+			payloadTypes[n] = false;
+		haveSsrc = false;
+		ssrc = 0;
+		newSsrc = 0;
+		newSsrcCount = 0;
+	}
+
+	void setPayloadInfo(const QList<PPayloadInfo> &info)
+	{
+		anyPayloadType = info.isEmpty();
+		for(int n = 0; n < 128; ++n)
+			payloadTypes[n] = false;
+		foreach(const PPayloadInfo &pi, info)
+		{
+			if(pi.id >= 0 && pi.id < 128)
+				payloadTypes[pi.id] = true;
+		}
+	}
+
+	bool check(const QByteArray &packet)
+	{
+		const unsigned char *p = (const unsigned char *)packet.constData();
+		int size = packet.size();
+
+		// fixed header, version 2, room for the csrc list
+		if(size < 12 || (p[0] >> 6) != 2 || size < 12 + (p[0] & 0x0f) * 4)
+		{
+			++badHeader;
+			return false;
+		}
+
+		// this also catches stray rtcp, which lands on 72-76
+		if(!anyPayloadType && !payloadTypes[p[1] & 0x7f])
+		{
+			++badPayloadType;
+			return false;
+		}
+
+		quint32 x = ((quint32)p[8] << 24) | ((quint32)p[9] << 16) | ((quint32)p[10] << 8) | (quint32)p[11];
+		if(!haveSsrc)
+		{
+			haveSsrc = true;
+			ssrc = x;
+		}
+		else if(x != ssrc)
+		{
+			// a sender that restarts gets a new ssrc, so follow
+			//   a new one once it proves to be steady
+			if(x == newSsrc)
+				++newSsrcCount;
+			else
+			{
+				newSsrc = x;
+				newSsrcCount = 1;
+			}
+
+			if(newSsrcCount < SSRC_SWITCH_PACKETS)
+			{
+				++badSsrc;
+				return false;
+			}
+
+			ssrc = x;
+		}
+
+		newSsrcCount = 0;
+		return true;
+	}
+};
+
+// outgoing packets refer directly to the payloader's buffers, rather than
+//   copying them.  this keeps a buffer alive for as long as any copy of the
+//   packet exists
+class GstBufferPacketData : public PRtpPacketData
+{
+public:
+	GstBuffer *buf;
+
+	GstBufferPacketData(GstBuffer *_buf) :
+		buf(gst_buffer_ref(_buf))
+	{
+	}
+
+	~GstBufferPacketData()
+	{
+		gst_buffer_unref(buf);
+	}
+
+	static void *operator new(size_t size);
+	static void operator delete(void *p, size_t size);
+};
+
+// the packet data is handed to apprtpsrc without copying, by giving it a
+//   copy of the packet that it drops once the buffer is freed.  this keeps
+//   both the QByteArray and any provider-owned memory behind it alive.
+//   we only ever read through constData(), so this never detaches.
+class PacketRef
+{
+public:
+	PRtpPacket packet;
+
+	PacketRef(const PRtpPacket &_packet) :
+		packet(_packet)
+	{
+	}
+
+	static void *operator new(size_t size);
+	static void operator delete(void *p, size_t size);
+};
+
+// both of the above are created and destroyed for every packet, so their
+//   memory is recycled
+#define PACKET_POOL_SIZE 256
+
+static PBlockCache<sizeof(GstBufferPacketData), PACKET_POOL_SIZE> bufferpacket_cache;
+static PBlockCache<sizeof(PacketRef), PACKET_POOL_SIZE> packetref_cache;
+
+// the QByteArray header of each packet can't be recycled, only counted
+static QBasicAtomicInt rawdata_headers = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+void *GstBufferPacketData::operator new(size_t size)
+{
+	return bufferpacket_cache.alloc(size);
+}
+
+void GstBufferPacketData::operator delete(void *p, size_t size)
+{
+	bufferpacket_cache.free(p, size);
+}
+
+void *PacketRef::operator new(size_t size)
+{
+	return packetref_cache.alloc(size);
+}
+
+void PacketRef::operator delete(void *p, size_t size)
+{
+	packetref_cache.free(p, size);
+}
+
+static PRtpPacket bufferToPacket(GstBuffer *buf, int portOffset)
+{
+	PRtpPacket packet;
+	rawdata_headers.ref();
+	packet.rawValue = QByteArray::fromRawData((const char *)GST_BUFFER_DATA(buf), GST_BUFFER_SIZE(buf));
+	packet.owner = new GstBufferPacketData(buf);
+	packet.portOffset = portOffset;
+	return packet;
+}
+
+static void free_buffer(gpointer data)
+{
+	gst_buffer_unref((GstBuffer *)data);
+}
+
+// pushes the buffers into rtpsrc, referencing rather than copying them
+static void push_buffers(GstElement *rtpsrc, GstBuffer **bufs, int count)
+{
+	QVarLengthArray<const unsigned char *, 64> datas;
+	QVarLengthArray<int, 64> sizes;
+	QVarLengthArray<gpointer, 64> refs;
+	for(int n = 0; n < count; ++n)
+	{
+		datas.append(GST_BUFFER_DATA(bufs[n]));
+		sizes.append(GST_BUFFER_SIZE(bufs[n]));
+		refs.append(gst_buffer_ref(bufs[n]));
+	}
+
+	gst_apprtpsrc_packet_push_wrapped_many((GstAppRtpSrc *)rtpsrc, datas.data(), sizes.data(), free_buffer, refs.data(), count);
+}
+
+// each stream has a single rtp session serving both directions, so that
+//   the SRs of our ssrc carry the report blocks for what we receive.  the
+//   sessions are built up front in a pipeline of their own, so that
+//   sending and receiving link into them in whichever order they start,
+//   and file preroll doesn't hold them up.  the send and receive
+//   pipelines are bridged to it by reference:
+//
+//     send pipeline -> sendsrc -> session -> sendsink -> app
+//     app -> recvsrc -> session -> recvsink -> receive pipeline (*rtpsrc)
+//     app -> rtcpsrc -> session -> rtcp sink -> app
+//
+// the sessions need the rtpmanager plugin.  without it, the streams are
+//   wired up directly and rtcp is not supported
+class StreamSession
+{
+public:
+	GstElement *bin;
+	GstElement *sendsrc;
+	GstElement *recvsrc;
+	GstElement *rtcpsrc;
+	GstElement *sendsink;
+
+	// the receive pipeline's apprtpsrc, once receiving
+	GstElement **rtpsrc;
+	QMutex *rtpsrc_mutex;
+};
+
+// the send pipeline's apprtpsink delivers here
+static void stream_session_send(GstBuffer **bufs, int count, gpointer data)
+{
+	StreamSession *ss = (StreamSession *)data;
+	push_buffers(ss->sendsrc, bufs, count);
+}
+
+static void stream_session_received(GstBuffer **bufs, int count, gpointer data)
+{
+	StreamSession *ss = (StreamSession *)data;
+	QMutexLocker locker(ss->rtpsrc_mutex);
+	if(*ss->rtpsrc)
+		push_buffers(*ss->rtpsrc, bufs, count);
+}
+
+// nothing in the session pipeline may hold up its preroll
+static GstElement *stream_session_sink()
+{
+	GstElement *sink = gst_element_factory_make("apprtpsink", NULL);
+	g_object_set(G_OBJECT(sink), "sync", FALSE, "async", FALSE, NULL);
+	return sink;
+}
+
+static StreamSession *stream_session_create(void (*rtp_cb)(GstBuffer **bufs, int count, gpointer appdata), void (*rtcp_cb)(GstBuffer *buf, gpointer appdata), gpointer appdata, GstElement **rtpsrc, QMutex *rtpsrc_mutex)
+{
+	GstElement *session = gst_element_factory_make("gstrtpsession", NULL);
+	if(!session)
+		return 0;
+
+	StreamSession *ss = new StreamSession;
+	ss->rtpsrc = rtpsrc;
+	ss->rtpsrc_mutex = rtpsrc_mutex;
+	ss->bin = gst_bin_new(NULL);
+
+	// caps of sendsrc are set once we know what we send, and of recvsrc
+	//   once we know the remote payload
+	ss->sendsrc = gst_element_factory_make("apprtpsrc", NULL);
+	ss->recvsrc = gst_element_factory_make("apprtpsrc", NULL);
+	ss->rtcpsrc = gst_element_factory_make("apprtpsrc", NULL);
+	GstCaps *caps = gst_caps_new_simple("application/x-rtcp", NULL);
+	g_object_set(G_OBJECT(ss->rtcpsrc), "caps", caps, NULL);
+	gst_caps_unref(caps);
+
+	ss->sendsink = stream_session_sink();
+	GstAppRtpSink *appRtpSink = (GstAppRtpSink *)ss->sendsink;
+	appRtpSink->appdata = appdata;
+	appRtpSink->packets_ready = rtp_cb;
+
+	GstElement *recvsink = stream_session_sink();
+	appRtpSink = (GstAppRtpSink *)recvsink;
+	appRtpSink->appdata = ss;
+	appRtpSink->packets_ready = stream_session_received;
+
+	GstElement *rtcpsink = stream_session_sink();
+	appRtpSink = (GstAppRtpSink *)rtcpsink;
+	appRtpSink->appdata = appdata;
+	appRtpSink->packet_ready_buffer = rtcp_cb;
+
+	// we don't do anything with the sync stream
+	GstElement *syncsink = gst_element_factory_make("fakesink", NULL);
+	g_object_set(G_OBJECT(syncsink), "sync", FALSE, "async", FALSE, NULL);
+
+	gst_bin_add(GST_BIN(ss->bin), session);
+	gst_bin_add(GST_BIN(ss->bin), ss->sendsrc);
+	gst_bin_add(GST_BIN(ss->bin), ss->recvsrc);
+	gst_bin_add(GST_BIN(ss->bin), ss->rtcpsrc);
+	gst_bin_add(GST_BIN(ss->bin), ss->sendsink);
+	gst_bin_add(GST_BIN(ss->bin), recvsink);
+	gst_bin_add(GST_BIN(ss->bin), rtcpsink);
+	gst_bin_add(GST_BIN(ss->bin), syncsink);
+
+	gst_element_link_pads(ss->sendsrc, "src", session, "send_rtp_sink");
+	gst_element_link_pads(session, "send_rtp_src", ss->sendsink, "sink");
+	gst_element_link_pads(ss->recvsrc, "src", session, "recv_rtp_sink");
+	gst_element_link_pads(session, "recv_rtp_src", recvsink, "sink");
+	gst_element_link_pads(ss->rtcpsrc, "src", session, "recv_rtcp_sink");
+	gst_element_link_pads(session, "send_rtcp_src", rtcpsink, "sink");
+	gst_element_link_pads(session, "sync_src", syncsink, "sink");
+
+	return ss;
+}
+
+// the session needs the clock rate of what we send for its SRs
+static void stream_session_set_send_caps(StreamSession *ss, GstElement *rtppay)
+{
+	GstPad *pad = gst_element_get_static_pad(rtppay, "src");
+	GstCaps *caps = gst_pad_get_negotiated_caps(pad);
+	gst_object_unref(pad);
+	if(!caps)
+		return;
+
+	g_object_set(G_OBJECT(ss->sendsrc), "caps", caps, NULL);
+	gst_caps_unref(caps);
+}
+
+// the ingress queue overflow policy can be tuned from the environment
+static void set_rtpsrc_policy(GstElement *rtpsrc)
+{
+	QString val;
+
+	val = QString::fromLatin1(qgetenv("PSI_RTP_IN_MAX_PACKETS"));
+	if(!val.isEmpty())
+		g_object_set(G_OBJECT(rtpsrc), "max-packets", val.toInt(), NULL);
+
+	val = QString::fromLatin1(qgetenv("PSI_RTP_IN_MAX_BYTES"));
+	if(!val.isEmpty())
+		g_object_set(G_OBJECT(rtpsrc), "max-bytes", val.toInt(), NULL);
+
+	val = QString::fromLatin1(qgetenv("PSI_RTP_IN_MAX_AGE"));
+	if(!val.isEmpty())
+		g_object_set(G_OBJECT(rtpsrc), "max-age", val.toInt(), NULL);
+}
+
+#ifdef RTPWORKER_DEBUG
+static void print_rtpsrc_stats(const char *name, GstElement *rtpsrc, const RtpInFilter *filter)
+{
+	printf("%s filter: bad header=%d, bad payload type=%d, bad ssrc=%d\n", name, filter->badHeader, filter->badPayloadType, filter->badSsrc);
+
+	if(!rtpsrc)
+		return;
+
+	int copied, allocated;
+	guint64 dropped, droppedBytes;
+	g_object_get(G_OBJECT(rtpsrc), "copied-packets", &copied, "allocated-buffers", &allocated, "dropped-packets", &dropped, "dropped-bytes", &droppedBytes, NULL);
+	printf("%s rtpsrc: copied packets=%d, allocated buffers=%d, dropped packets=%" G_GUINT64_FORMAT ", dropped bytes=%" G_GUINT64_FORMAT "\n", name, copied, allocated, dropped, droppedBytes);
+}
+#endif
+
+// outgoing video is paced to the session bitrate.  the burst allowance
+//   can be tuned from the environment
+static GstElement *pacer_create(int kbps)
+{
+	GstElement *pacer = gst_element_factory_make("rtppacer", NULL);
+	if(!pacer)
+		return 0;
+
+	g_object_set(G_OBJECT(pacer), "bitrate", kbps, NULL);
+
+	QString val = QString::fromLatin1(qgetenv("PSI_RTP_PACER_BURST"));
+	if(!val.isEmpty())
+		g_object_set(G_OBJECT(pacer), "burst", val.toInt(), NULL);
+
+	return pacer;
+}
+
+// if the pacer had to hold anything back, the bitrate may be set too low
+//   for what the encoder produces, so this is reported in any build
+static void print_pacer_stats(const char *name, GstElement *pacer)
+{
+	int delay, maxDelay;
+	guint64 delayed, dropped;
+	g_object_get(G_OBJECT(pacer), "queue-delay", &delay, "max-queue-delay", &maxDelay, "delayed-packets", &delayed, "dropped-packets", &dropped, NULL);
+#ifdef RTPWORKER_DEBUG
+	printf("%s pacer: queue delay=%dus, max queue delay=%dus, delayed packets=%" G_GUINT64_FORMAT ", dropped packets=%" G_GUINT64_FORMAT "\n", name, delay, maxDelay, delayed, dropped);
+#else
+	if(delayed > 0 || dropped > 0)
+		qWarning("psimedia: %s pacer: max queue delay=%dus, delayed packets=%" G_GUINT64_FORMAT ", dropped packets=%" G_GUINT64_FORMAT, name, maxDelay, delayed, dropped);
+#endif
+}
+
+#ifdef RTPWORKER_DEBUG
+static void print_packet_pool_stats()
+{
+	printf("packet pool: allocated=%d, recycled=%d, list nodes allocated=%d, recycled=%d, unrecycled headers=%d\n", bufferpacket_cache.allocatedCount() + packetref_cache.allocatedCount(), bufferpacket_cache.recycledCount() + packetref_cache.recycledCount(), prtppacket_cache().allocatedCount(), prtppacket_cache().recycledCount(), rawdata_headers.fetchAndAddRelaxed(0));
+}
+#endif
+
 #ifdef RTPWORKER_DEBUG
 static void dump_pipeline(GstElement *in, int indent = 0)
 {
@@ -176,19 +574,9 @@ static void dump_pipeline(GstElement *in, int indent = 0)
 //----------------------------------------------------------------------------
 // RtpWorker
 //----------------------------------------------------------------------------
-static int worker_refs = 0;
-static PipelineContext *send_pipelineContext = 0;
-static PipelineContext *recv_pipelineContext = 0;
-static GstElement *spipeline = 0;
-static GstElement *rpipeline = 0;
-//static GstBus *sbus = 0;
-static bool send_in_use = false;
-static bool recv_in_use = false;
-
-static bool use_shared_clock = true;
-static GstClock *shared_clock = 0;
-static bool send_clock_is_shared = false;
-//static bool recv_clock_is_shared = false;
+// how long the send pipeline may take to start, in ms.  6 seconds ought to
+//   be enough time to init
+#define DEFAULT_START_TIMEOUT 6000
 
 RtpWorker::RtpWorker(GMainContext *mainContext) :
 	app(0),
@@ -210,9 +598,25 @@ RtpWorker::RtpWorker(GMainContext *mainContext) :
 	cb_outputFrame(0),
 	cb_rtpAudioOut(0),
 	cb_rtpVideoOut(0),
+	cb_rtpAudioOutBatch(0),
+	cb_rtpVideoOutBatch(0),
 	cb_recordData(0),
 	mainContext_(mainContext),
 	timer(0),
+	stateWatch(0),
+	stateTimer(0),
+	send_pending(false),
+	pending_cb(PendingNone),
+	recvStateWatch(0),
+	recvStateTimer(0),
+	send_in_use(false),
+	recv_in_use(false),
+	audioSession(0),
+	videoSession(0),
+	session_in_use(false),
+	use_shared_clock(true),
+	shared_clock(0),
+	send_clock_is_shared(false),
 	pd_audiosrc(0),
 	pd_videosrc(0),
 	pd_audiosink(0),
@@ -225,6 +629,11 @@ RtpWorker::RtpWorker(GMainContext *mainContext) :
 	videortpsrc(0),
 	audiortppay(0),
 	videortppay(0),
+	videopacer(0),
+	audiortcpsrc(0),
+	videortcpsrc(0),
+	audiortpsrc_session(0),
+	videortpsrc_session(0),
 	volumein(0),
 	volumeout(0),
 	rtpaudioout(false),
@@ -233,29 +642,32 @@ RtpWorker::RtpWorker(GMainContext *mainContext) :
 {
 	audioStats = new Stats("audio");
 	videoStats = new Stats("video");
+	audioInFilter = new RtpInFilter;
+	videoInFilter = new RtpInFilter;
 
-	if(worker_refs == 0)
-	{
-		send_pipelineContext = new PipelineContext;
-		recv_pipelineContext = new PipelineContext;
+	startTimeout = qgetenv("PSI_RTP_START_TIMEOUT").toInt();
+	if(startTimeout <= 0)
+		startTimeout = DEFAULT_START_TIMEOUT;
+
+	send_pipelineContext = new PipelineContext;
+	recv_pipelineContext = new PipelineContext;
+	session_pipelineContext = new PipelineContext;
 
-		spipeline = send_pipelineContext->element();
-		rpipeline = recv_pipelineContext->element();
+	spipeline = send_pipelineContext->element();
+	rpipeline = recv_pipelineContext->element();
+	sesspipeline = session_pipelineContext->element();
 
 #ifdef RTPWORKER_DEBUG
-		/*sbus = gst_pipeline_get_bus(GST_PIPELINE(spipeline));
-		GSource *source = gst_bus_create_watch(bus);
-		gst_object_unref(bus);
-		g_source_set_callback(source, (GSourceFunc)cb_bus_call, this, NULL);
-		g_source_attach(source, mainContext_);*/
+	/*GstBus *sbus = gst_pipeline_get_bus(GST_PIPELINE(spipeline));
+	GSource *source = gst_bus_create_watch(sbus);
+	gst_object_unref(sbus);
+	g_source_set_callback(source, (GSourceFunc)cb_bus_call, this, NULL);
+	g_source_attach(source, mainContext_);*/
 #endif
 
-		QByteArray val = qgetenv("PSI_NO_SHARED_CLOCK");
-		if(!val.isEmpty())
-			use_shared_clock = false;
-	}
-
-	++worker_refs;
+	QByteArray val = qgetenv("PSI_NO_SHARED_CLOCK");
+	if(!val.isEmpty())
+		use_shared_clock = false;
 }
 
 RtpWorker::~RtpWorker()
@@ -274,20 +686,14 @@ RtpWorker::~RtpWorker()
 
 	cleanup();
 
-	--worker_refs;
-	if(worker_refs == 0)
-	{
-		delete send_pipelineContext;
-		send_pipelineContext = 0;
-
-		delete recv_pipelineContext;
-		recv_pipelineContext = 0;
-
-		//sbus = 0;
-	}
+	delete send_pipelineContext;
+	delete recv_pipelineContext;
+	delete session_pipelineContext;
 
 	delete audioStats;
 	delete videoStats;
+	delete audioInFilter;
+	delete videoInFilter;
 }
 
 void RtpWorker::cleanup()
@@ -295,6 +701,9 @@ void RtpWorker::cleanup()
 #ifdef RTPWORKER_DEBUG
 	printf("cleaning up...\n");
 #endif
+	stopSendWatch();
+	stopRecvWatch();
+
 	volumein_mutex.lock();
 	volumein = 0;
 	volumein_mutex.unlock();
@@ -304,13 +713,36 @@ void RtpWorker::cleanup()
 	volumeout_mutex.unlock();
 
 	audiortpsrc_mutex.lock();
+#ifdef RTPWORKER_DEBUG
+	print_rtpsrc_stats("audio", audiortpsrc, audioInFilter);
+#endif
 	audiortpsrc = 0;
+	audiortpsrc_session = 0;
 	audiortpsrc_mutex.unlock();
 
 	videortpsrc_mutex.lock();
+#ifdef RTPWORKER_DEBUG
+	print_rtpsrc_stats("video", videortpsrc, videoInFilter);
+#endif
 	videortpsrc = 0;
+	videortpsrc_session = 0;
 	videortpsrc_mutex.unlock();
 
+	if(videopacer)
+		print_pacer_stats("video", videopacer);
+#ifdef RTPWORKER_DEBUG
+	print_packet_pool_stats();
+#endif
+	videopacer = 0;
+
+	audiortcpsrc_mutex.lock();
+	audiortcpsrc = 0;
+	audiortcpsrc_mutex.unlock();
+
+	videortcpsrc_mutex.lock();
+	videortcpsrc = 0;
+	videortcpsrc_mutex.unlock();
+
 	rtpaudioout_mutex.lock();
 	rtpaudioout = false;
 	rtpaudioout_mutex.unlock();
@@ -327,27 +759,13 @@ void RtpWorker::cleanup()
 
 	if(sendbin)
 	{
+		// the receive pipeline, if any, is torn down below and
+		//   reverts to its own clock then
 		if(shared_clock && send_clock_is_shared)
 		{
 			gst_object_unref(shared_clock);
 			shared_clock = 0;
 			send_clock_is_shared = false;
-
-			if(recv_in_use)
-			{
-				printf("recv clock reverts to auto\n");
-				gst_element_set_state(rpipeline, GST_STATE_READY);
-				gst_element_get_state(rpipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
-				gst_pipeline_auto_clock(GST_PIPELINE(rpipeline));
-
-				// only restart the receive pipeline if it is
-				//   owned by a separate session
-				if(!recvbin)
-				{
-					gst_element_set_state(rpipeline, GST_STATE_PLAYING);
-					//gst_element_get_state(rpipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
-				}
-			}
 		}
 
 		send_pipelineContext->deactivate();
@@ -396,6 +814,9 @@ void RtpWorker::cleanup()
 		recv_in_use = false;
 	}
 
+	// after the send pipeline, which delivers into the sessions
+	stopSessions();
+
 	if(pd_audiosrc)
 	{
 		delete pd_audiosrc;
@@ -412,6 +833,8 @@ void RtpWorker::cleanup()
 
 	if(pd_audiosink)
 	{
+		if(pd_audiosrc)
+			pd_audiosrc->setEchoPlayback(0);
 		delete pd_audiosink;
 		pd_audiosink = 0;
 	}
@@ -472,18 +895,114 @@ void RtpWorker::stop()
 	g_source_attach(timer, mainContext_);
 }
 
+static void free_packet(gpointer data)
+{
+	delete (PacketRef *)data;
+}
+
+static void push_raw(GstElement *rtpsrc, const PRtpPacket &packet)
+{
+	PacketRef *p = new PacketRef(packet);
+	gst_apprtpsrc_packet_push_wrapped((GstAppRtpSrc *)rtpsrc, (const unsigned char *)p->packet.rawValue.constData(), p->packet.rawValue.size(), free_packet, p);
+}
+
+// sessionsrc, if set, is the stream's session, which passes the packet
+//   on to rtpsrc
+static void push_packet(GstElement *rtpsrc, GstElement *sessionsrc, RtpInFilter *filter, const PRtpPacket &packet)
+{
+	if(filter->check(packet.rawValue))
+		push_raw(sessionsrc ? sessionsrc : rtpsrc, packet);
+}
+
+static void push_rtcp(GstElement *rtcpsrc, const PRtpPacket &packet)
+{
+	const unsigned char *p = (const unsigned char *)packet.rawValue.constData();
+	int size = packet.rawValue.size();
+
+	// a compound packet always starts with an SR or RR
+	if(size < 8 || (p[0] >> 6) != 2 || (p[1] != 200 && p[1] != 201))
+		return;
+
+	if(rtcpsrc)
+		push_raw(rtcpsrc, packet);
+}
+
+static void push_packets(GstElement *rtpsrc, GstElement *sessionsrc, RtpInFilter *filter, const QList<PRtpPacket> &packets)
+{
+	QVarLengthArray<const unsigned char *, 64> bufs;
+	QVarLengthArray<int, 64> sizes;
+	QVarLengthArray<gpointer, 64> ps;
+	foreach(const PRtpPacket &packet, packets)
+	{
+		if(packet.portOffset != 0 || !filter->check(packet.rawValue))
+			continue;
+
+		PacketRef *p = new PacketRef(packet);
+		bufs.append((const unsigned char *)p->packet.rawValue.constData());
+		sizes.append(p->packet.rawValue.size());
+		ps.append(p);
+	}
+
+	if(bufs.isEmpty())
+		return;
+
+	gst_apprtpsrc_packet_push_wrapped_many((GstAppRtpSrc *)(sessionsrc ? sessionsrc : rtpsrc), bufs.data(), sizes.data(), free_packet, ps.data(), bufs.count());
+}
+
 void RtpWorker::rtpAudioIn(const PRtpPacket &packet)
 {
+	if(packet.portOffset == 1)
+	{
+		QMutexLocker locker(&audiortcpsrc_mutex);
+		push_rtcp(audiortcpsrc, packet);
+		return;
+	}
+
 	QMutexLocker locker(&audiortpsrc_mutex);
 	if(packet.portOffset == 0 && audiortpsrc)
-		gst_apprtpsrc_packet_push((GstAppRtpSrc *)audiortpsrc, (const unsigned char *)packet.rawValue.data(), packet.rawValue.size());
+		push_packet(audiortpsrc, audiortpsrc_session, audioInFilter, packet);
 }
 
 void RtpWorker::rtpVideoIn(const PRtpPacket &packet)
 {
+	if(packet.portOffset == 1)
+	{
+		QMutexLocker locker(&videortcpsrc_mutex);
+		push_rtcp(videortcpsrc, packet);
+		return;
+	}
+
 	QMutexLocker locker(&videortpsrc_mutex);
 	if(packet.portOffset == 0 && videortpsrc)
-		gst_apprtpsrc_packet_push((GstAppRtpSrc *)videortpsrc, (const unsigned char *)packet.rawValue.data(), packet.rawValue.size());
+		push_packet(videortpsrc, videortpsrc_session, videoInFilter, packet);
+}
+
+void RtpWorker::rtpAudioIn(const QList<PRtpPacket> &packets)
+{
+	// rtcp is rare enough to not bother batching
+	foreach(const PRtpPacket &packet, packets)
+	{
+		if(packet.portOffset == 1)
+			rtpAudioIn(packet);
+	}
+
+	QMutexLocker locker(&audiortpsrc_mutex);
+	if(audiortpsrc)
+		push_packets(audiortpsrc, audiortpsrc_session, audioInFilter, packets);
+}
+
+void RtpWorker::rtpVideoIn(const QList<PRtpPacket> &packets)
+{
+	// rtcp is rare enough to not bother batching
+	foreach(const PRtpPacket &packet, packets)
+	{
+		if(packet.portOffset == 1)
+			rtpVideoIn(packet);
+	}
+
+	QMutexLocker locker(&videortpsrc_mutex);
+	if(videortpsrc)
+		push_packets(videortpsrc, videortpsrc_session, videoInFilter, packets);
 }
 
 void RtpWorker::setOutputVolume(int level)
@@ -566,14 +1085,24 @@ void RtpWorker::cb_show_frame_output(int width, int height, const unsigned char
 	((RtpWorker *)data)->show_frame_output(width, height, rgb32);
 }
 
-void RtpWorker::cb_packet_ready_rtp_audio(const unsigned char *buf, int size, gpointer data)
+void RtpWorker::cb_packets_ready_rtp_audio(GstBuffer **bufs, int count, gpointer data)
+{
+	((RtpWorker *)data)->packets_ready_rtp_audio(bufs, count);
+}
+
+void RtpWorker::cb_packets_ready_rtp_video(GstBuffer **bufs, int count, gpointer data)
+{
+	((RtpWorker *)data)->packets_ready_rtp_video(bufs, count);
+}
+
+void RtpWorker::cb_packet_ready_rtcp_audio(GstBuffer *buf, gpointer data)
 {
-	((RtpWorker *)data)->packet_ready_rtp_audio(buf, size);
+	((RtpWorker *)data)->packet_ready_rtcp_audio(buf);
 }
 
-void RtpWorker::cb_packet_ready_rtp_video(const unsigned char *buf, int size, gpointer data)
+void RtpWorker::cb_packet_ready_rtcp_video(GstBuffer *buf, gpointer data)
 {
-	((RtpWorker *)data)->packet_ready_rtp_video(buf, size);
+	((RtpWorker *)data)->packet_ready_rtcp_video(buf);
 }
 
 gboolean RtpWorker::cb_fileReady(gpointer data)
@@ -592,6 +1121,11 @@ gboolean RtpWorker::doStart()
 	videortpsrc = 0;
 	audiortppay = 0;
 	videortppay = 0;
+	videopacer = 0;
+	audiortcpsrc = 0;
+	videortcpsrc = 0;
+	audiortpsrc_session = 0;
+	videortpsrc_session = 0;
 
 	// default to 400kbps
 	if(maxbitrate == -1)
@@ -602,6 +1136,11 @@ gboolean RtpWorker::doStart()
 		if(cb_error)
 			cb_error(app);
 	}
+	else if(send_pending)
+	{
+		// signaled from sendStateDone() instead
+		pending_cb = PendingStarted;
+	}
 	else
 	{
 		// don't signal started here if using files
@@ -616,11 +1155,25 @@ gboolean RtpWorker::doUpdate()
 {
 	timer = 0;
 
-	if(!setupSendRecv())
+	// default to 400kbps
+	if(maxbitrate == -1)
+		maxbitrate = 400;
+
+	bool ok = setupSendRecv();
+
+	// the pacer follows the bitrate we're allowed to send at
+	if(ok && videopacer)
+		g_object_set(G_OBJECT(videopacer), "bitrate", videoKbps(), NULL);
+
+	if(!ok)
 	{
 		if(cb_error)
 			cb_error(app);
 	}
+	else if(send_pending)
+	{
+		pending_cb = PendingUpdated;
+	}
 	else
 	{
 		if(cb_updated)
@@ -634,6 +1187,7 @@ gboolean RtpWorker::doStop()
 {
 	timer = 0;
 
+	pending_cb = PendingNone;
 	cleanup();
 
 	if(cb_stopped)
@@ -649,7 +1203,7 @@ void RtpWorker::fileDemux_no_more_pads(GstElement *element)
 	printf("no more pads\n");
 #endif
 
-	// FIXME: make this get canceled on cleanup?
+	// fileReady() does nothing if we were cleaned up meanwhile
 	GSource *ftimer = g_timeout_source_new(0);
 	g_source_set_callback(ftimer, cb_fileReady, this, NULL);
 	g_source_attach(ftimer, mainContext_);
@@ -854,40 +1408,86 @@ void RtpWorker::show_frame_output(int width, int height, const unsigned char *rg
 		cb_outputFrame(frame, app);
 }
 
-void RtpWorker::packet_ready_rtp_audio(const unsigned char *buf, int size)
+void RtpWorker::packets_ready_rtp_audio(GstBuffer **bufs, int count)
 {
-	QByteArray ba((const char *)buf, size);
-	PRtpPacket packet;
-	packet.rawValue = ba;
-	packet.portOffset = 0;
+	QList<PRtpPacket> packets;
+	for(int n = 0; n < count; ++n)
+	{
+		PRtpPacket packet = bufferToPacket(bufs[n], 0);
 
 #ifdef RTPWORKER_DEBUG
-	audioStats->print_stats(packet.rawValue.size());
+		audioStats->print_stats(packet.rawValue.size());
 #endif
 
+		packets += packet;
+	}
+
 	QMutexLocker locker(&rtpaudioout_mutex);
-	if(cb_rtpAudioOut && rtpaudioout)
-		cb_rtpAudioOut(packet, app);
+	if(!rtpaudioout)
+		return;
+
+	if(cb_rtpAudioOutBatch)
+		cb_rtpAudioOutBatch(packets, app);
+	else if(cb_rtpAudioOut)
+	{
+		foreach(const PRtpPacket &packet, packets)
+			cb_rtpAudioOut(packet, app);
+	}
 }
 
-void RtpWorker::packet_ready_rtp_video(const unsigned char *buf, int size)
+void RtpWorker::packets_ready_rtp_video(GstBuffer **bufs, int count)
 {
-	QByteArray ba((const char *)buf, size);
-	PRtpPacket packet;
-	packet.rawValue = ba;
-	packet.portOffset = 0;
+	QList<PRtpPacket> packets;
+	for(int n = 0; n < count; ++n)
+	{
+		PRtpPacket packet = bufferToPacket(bufs[n], 0);
 
 #ifdef RTPWORKER_DEBUG
-	videoStats->print_stats(packet.rawValue.size());
+		videoStats->print_stats(packet.rawValue.size());
 #endif
 
+		packets += packet;
+	}
+
 	QMutexLocker locker(&rtpvideoout_mutex);
-	if(cb_rtpVideoOut && rtpvideoout)
+	if(!rtpvideoout)
+		return;
+
+	if(cb_rtpVideoOutBatch)
+		cb_rtpVideoOutBatch(packets, app);
+	else if(cb_rtpVideoOut)
+	{
+		foreach(const PRtpPacket &packet, packets)
+			cb_rtpVideoOut(packet, app);
+	}
+}
+
+// note: rtcp goes out whether or not we are transmitting, since receiver
+//   reports are still wanted when we only receive
+
+void RtpWorker::packet_ready_rtcp_audio(GstBuffer *buf)
+{
+	PRtpPacket packet = bufferToPacket(buf, 1);
+
+	QMutexLocker locker(&rtpaudioout_mutex);
+	if(cb_rtpAudioOut)
+		cb_rtpAudioOut(packet, app);
+}
+
+void RtpWorker::packet_ready_rtcp_video(GstBuffer *buf)
+{
+	PRtpPacket packet = bufferToPacket(buf, 1);
+
+	QMutexLocker locker(&rtpvideoout_mutex);
+	if(cb_rtpVideoOut)
 		cb_rtpVideoOut(packet, app);
 }
 
 gboolean RtpWorker::fileReady()
 {
+	if(!send_pending || !sendbin)
+		return FALSE;
+
 	if(loopFile)
 	{
 		//gst_element_set_state(sendPipeline, GST_STATE_PAUSED);
@@ -898,21 +1498,10 @@ gboolean RtpWorker::fileReady()
 			GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_END, 0);*/
 	}
 
+	// the send watch reports started once this is playing
 	send_pipelineContext->activate();
-	gst_element_get_state(send_pipelineContext->element(), NULL, NULL, GST_CLOCK_TIME_NONE);
 	//gst_element_set_state(sendPipeline, GST_STATE_PLAYING);
 	//gst_element_get_state(sendPipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
-
-	if(!getCaps())
-	{
-		error = RtpSessionContext::ErrorCodec;
-		if(cb_error)
-			cb_error(app);
-		return FALSE;
-	}
-
-	if(cb_started)
-		cb_started(app);
 	return FALSE;
 }
 
@@ -934,6 +1523,8 @@ bool RtpWorker::setupSendRecv()
 	//   - once sending or receiving is started, devices can't be changed
 	//     (changes will be ignored)
 
+	startSessions();
+
 	if(!sendbin)
 	{
 		if(!localAudioParams.isEmpty() || !localVideoParams.isEmpty())
@@ -968,14 +1559,95 @@ bool RtpWorker::setupSendRecv()
 		updateTheoraConfig();
 	}
 
+	applyActualPayloadInfo();
+	return true;
+}
+
+void RtpWorker::startSessions()
+{
+	if(session_in_use)
+		return;
+
+	if(!localAudioParams.isEmpty())
+		audioSession = stream_session_create(cb_packets_ready_rtp_audio, cb_packet_ready_rtcp_audio, this, &audiortpsrc, &audiortpsrc_mutex);
+	if(!localVideoParams.isEmpty())
+		videoSession = stream_session_create(cb_packets_ready_rtp_video, cb_packet_ready_rtcp_video, this, &videortpsrc, &videortpsrc_mutex);
+
+	if(!audioSession && !videoSession)
+		return;
+
+	if(audioSession)
+	{
+		PipelineContext::markAudioElement(audioSession->sendsrc);
+		PipelineContext::markAudioElement(audioSession->recvsrc);
+		gst_bin_add(GST_BIN(sesspipeline), audioSession->bin);
+	}
+	if(videoSession)
+	{
+		PipelineContext::markVideoElement(videoSession->sendsrc);
+		PipelineContext::markVideoElement(videoSession->recvsrc);
+		gst_bin_add(GST_BIN(sesspipeline), videoSession->bin);
+	}
+
+	// everything in there is live or doesn't preroll, so this completes
+	//   right away
+	session_pipelineContext->activate();
+	session_in_use = true;
+
+	if(audioSession)
+	{
+		audiortcpsrc_mutex.lock();
+		audiortcpsrc = audioSession->rtcpsrc;
+		audiortcpsrc_mutex.unlock();
+
+		audiortpsrc_mutex.lock();
+		audiortpsrc_session = audioSession->recvsrc;
+		audiortpsrc_mutex.unlock();
+	}
+	if(videoSession)
+	{
+		videortcpsrc_mutex.lock();
+		videortcpsrc = videoSession->rtcpsrc;
+		videortcpsrc_mutex.unlock();
+
+		videortpsrc_mutex.lock();
+		videortpsrc_session = videoSession->recvsrc;
+		videortpsrc_mutex.unlock();
+	}
+}
+
+// the pointers into the sessions are cleared by cleanup() beforehand
+void RtpWorker::stopSessions()
+{
+	if(!session_in_use)
+		return;
+
+	session_pipelineContext->deactivate();
+
+	if(audioSession)
+	{
+		gst_bin_remove(GST_BIN(sesspipeline), audioSession->bin);
+		delete audioSession;
+		audioSession = 0;
+	}
+	if(videoSession)
+	{
+		gst_bin_remove(GST_BIN(sesspipeline), videoSession->bin);
+		delete videoSession;
+		videoSession = 0;
+	}
+
+	session_in_use = false;
+}
+
+void RtpWorker::applyActualPayloadInfo()
+{
 	// apply actual settings back to these variables, so the user can
 	//   read them
 	localAudioPayloadInfo = actual_localAudioPayloadInfo;
 	localVideoPayloadInfo = actual_localVideoPayloadInfo;
 	remoteAudioPayloadInfo = actual_remoteAudioPayloadInfo;
 	remoteVideoPayloadInfo = actual_remoteVideoPayloadInfo;
-
-	return true;
 }
 
 bool RtpWorker::startSend()
@@ -1035,6 +1707,9 @@ bool RtpWorker::startSend(int rate)
 			}
 
 			audiosrc = pd_audiosrc->element();
+
+			// cancel the echo of our own playback, if receiving already
+			pd_audiosrc->setEchoPlayback(pd_audiosink);
 		}
 
 		if(!vin.isEmpty() && !localVideoParams.isEmpty())
@@ -1102,11 +1777,18 @@ bool RtpWorker::startSend(int rate)
 
 	gst_bin_add(GST_BIN(spipeline), sendbin);
 
+	// nothing reads the bus outside of startup, so drop whatever
+	//   is left there from before
+	GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(spipeline));
+	GstMessage *msg;
+	while((msg = gst_bus_pop(bus)) != NULL)
+		gst_message_unref(msg);
+
 	if(!audiosrc && !videosrc)
 	{
-		// in the case of files, preroll
+		// in the case of files, preroll.  fileReady() sets the pipeline
+		//   playing once the demuxer has found the streams
 		gst_element_set_state(spipeline, GST_STATE_PAUSED);
-		gst_element_get_state(spipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
 		//gst_element_set_state(sendbin, GST_STATE_PAUSED);
 		//gst_element_get_state(sendbin, NULL, NULL, GST_CLOCK_TIME_NONE);
 
@@ -1148,56 +1830,263 @@ bool RtpWorker::startSend(int rate)
 		//gst_element_set_state(pipeline, GST_STATE_PLAYING);
 		//gst_element_get_state(pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
 		send_pipelineContext->activate();
+	}
 
-		// 6 seconds ought to be enough time to init
-		int ret = gst_element_get_state(spipeline, NULL, NULL, 6 * GST_SECOND);
-		//gst_element_get_state(sendbin, NULL, NULL, GST_CLOCK_TIME_NONE);
-		if(ret != GST_STATE_CHANGE_SUCCESS && ret != GST_STATE_CHANGE_NO_PREROLL)
+	// opening devices or prerolling a file can take seconds, and this
+	//   thread serves other sessions too, so don't wait for it here.
+	//   instead the bus is watched, and finishSend() is called once the
+	//   pipeline is playing
+	send_pending = true;
+	stateWatch = gst_bus_create_watch(bus);
+	g_source_set_callback(stateWatch, (GSourceFunc)cb_sendBusCall, this, NULL);
+	g_source_attach(stateWatch, mainContext_);
+
+	stateTimer = g_timeout_source_new(startTimeout);
+	g_source_set_callback(stateTimer, cb_sendTimeout, this, NULL);
+	g_source_attach(stateTimer, mainContext_);
+
+	// the pipeline may have been playing already, in which case no
+	//   state change is coming.  this makes sure it is looked at once
+	gst_bus_post(bus, gst_message_new_application(GST_OBJECT(spipeline), gst_structure_empty_new("psi-check-state")));
+	gst_object_unref(bus);
+
+	return true;
+}
+
+// called once the send pipeline is playing
+bool RtpWorker::finishSend()
+{
+	// a file plays at its own pace, so only live sources lead the clock
+	if(!fileDemux && !shared_clock && use_shared_clock)
+	{
+		printf("send clock is master\n");
+
+		shared_clock = gst_pipeline_get_clock(GST_PIPELINE(spipeline));
+		gst_pipeline_use_clock(GST_PIPELINE(spipeline), shared_clock);
+		send_clock_is_shared = true;
+
+		// if recv active, apply this clock to it.  going down to READY
+		//   completes within set_state, so there is nothing to wait for
+		if(recv_in_use)
 		{
+			printf("recv pipeline slaving to send clock\n");
+			gst_element_set_state(rpipeline, GST_STATE_READY);
+			gst_pipeline_use_clock(GST_PIPELINE(rpipeline), shared_clock);
+			gst_element_set_state(rpipeline, GST_STATE_PLAYING);
+		}
+	}
+
 #ifdef RTPWORKER_DEBUG
-			printf("error/timeout while setting send pipeline to PLAYING\n");
+	printf("state changed\n");
+
+	dump_pipeline(spipeline);
 #endif
-			cleanup();
-			error = RtpSessionContext::ErrorGeneric;
-			return false;
-		}
 
-		if(!shared_clock && use_shared_clock)
-		{
-			printf("send clock is master\n");
+	if(!getCaps())
+	{
+		error = RtpSessionContext::ErrorCodec;
+		return false;
+	}
 
-			shared_clock = gst_pipeline_get_clock(GST_PIPELINE(spipeline));
-			gst_pipeline_use_clock(GST_PIPELINE(spipeline), shared_clock);
-			send_clock_is_shared = true;
+	if(audioSession && audiortppay)
+		stream_session_set_send_caps(audioSession, audiortppay);
+	if(videoSession && videortppay)
+		stream_session_set_send_caps(videoSession, videortppay);
+
+	actual_localAudioPayloadInfo = localAudioPayloadInfo;
+	actual_localVideoPayloadInfo = localVideoPayloadInfo;
+
+	return true;
+}
+
+gboolean RtpWorker::cb_sendBusCall(GstBus *bus, GstMessage *msg, gpointer data)
+{
+	Q_UNUSED(bus);
+	return ((RtpWorker *)data)->sendBusCall(msg);
+}
+
+gboolean RtpWorker::cb_sendTimeout(gpointer data)
+{
+	return ((RtpWorker *)data)->sendTimeout();
+}
+
+gboolean RtpWorker::sendBusCall(GstMessage *msg)
+{
+	switch(GST_MESSAGE_TYPE(msg))
+	{
+		case GST_MESSAGE_ERROR:
+		{
+			sendStateDone(false);
+			return FALSE;
+		}
+		case GST_MESSAGE_STATE_CHANGED:
+		case GST_MESSAGE_ASYNC_DONE:
+		case GST_MESSAGE_APPLICATION:
+		{
+			// state changes of the elements inside don't tell us much
+			if(GST_MESSAGE_SRC(msg) != GST_OBJECT(spipeline))
+				return TRUE;
 
-			// if recv active, apply this clock to it
-			if(recv_in_use)
+			GstState state;
+			GstStateChangeReturn ret = gst_element_get_state(spipeline, &state, NULL, 0);
+			if(ret == GST_STATE_CHANGE_FAILURE)
 			{
-				printf("recv pipeline slaving to send clock\n");
-				gst_element_set_state(rpipeline, GST_STATE_READY);
-				gst_element_get_state(rpipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
-				gst_pipeline_use_clock(GST_PIPELINE(rpipeline), shared_clock);
-				gst_element_set_state(rpipeline, GST_STATE_PLAYING);
+				sendStateDone(false);
+				return FALSE;
 			}
+			else if(ret != GST_STATE_CHANGE_ASYNC && state == GST_STATE_PLAYING)
+			{
+				sendStateDone(true);
+				return FALSE;
+			}
+			return TRUE;
 		}
+		default:
+			return TRUE;
+	}
+}
 
-#ifdef RTPWORKER_DEBUG
-		printf("state changed\n");
+gboolean RtpWorker::sendTimeout()
+{
+	sendStateDone(false);
+	return FALSE;
+}
 
-		dump_pipeline(spipeline);
-#endif
+gboolean RtpWorker::cb_recvBusCall(GstBus *bus, GstMessage *msg, gpointer data)
+{
+	Q_UNUSED(bus);
+	return ((RtpWorker *)data)->recvBusCall(msg);
+}
 
-		if(!getCaps())
+gboolean RtpWorker::cb_recvTimeout(gpointer data)
+{
+	return ((RtpWorker *)data)->recvTimeout();
+}
+
+gboolean RtpWorker::recvBusCall(GstMessage *msg)
+{
+	switch(GST_MESSAGE_TYPE(msg))
+	{
+		case GST_MESSAGE_ERROR:
 		{
-			error = RtpSessionContext::ErrorCodec;
-			return false;
+			recvFailed();
+			return FALSE;
 		}
+		case GST_MESSAGE_STATE_CHANGED:
+		case GST_MESSAGE_ASYNC_DONE:
+		case GST_MESSAGE_APPLICATION:
+		{
+			if(GST_MESSAGE_SRC(msg) != GST_OBJECT(rpipeline))
+				return TRUE;
 
-		actual_localAudioPayloadInfo = localAudioPayloadInfo;
-		actual_localVideoPayloadInfo = localVideoPayloadInfo;
+			GstState state;
+			GstStateChangeReturn ret = gst_element_get_state(rpipeline, &state, NULL, 0);
+			if(ret == GST_STATE_CHANGE_FAILURE)
+			{
+				recvFailed();
+				return FALSE;
+			}
+			else if(ret != GST_STATE_CHANGE_ASYNC && state == GST_STATE_PLAYING)
+			{
+				stopRecvWatch();
+				return FALSE;
+			}
+			return TRUE;
+		}
+		default:
+			return TRUE;
 	}
+}
 
-	return true;
+gboolean RtpWorker::recvTimeout()
+{
+	// nothing received yet, which is fine.  stop watching
+	stopRecvWatch();
+	return FALSE;
+}
+
+void RtpWorker::recvFailed()
+{
+#ifdef RTPWORKER_DEBUG
+	printf("error while setting recv pipeline to PLAYING\n");
+#endif
+	// the session may be started already, in which case the error is
+	//   reported all the same
+	pending_cb = PendingNone;
+	cleanup();
+	error = RtpSessionContext::ErrorGeneric;
+	if(cb_error)
+		cb_error(app);
+}
+
+void RtpWorker::stopRecvWatch()
+{
+	if(recvStateWatch)
+	{
+		g_source_destroy(recvStateWatch);
+		recvStateWatch = 0;
+	}
+	if(recvStateTimer)
+	{
+		g_source_destroy(recvStateTimer);
+		recvStateTimer = 0;
+	}
+}
+
+void RtpWorker::stopSendWatch()
+{
+	if(stateWatch)
+	{
+		g_source_destroy(stateWatch);
+		stateWatch = 0;
+	}
+	if(stateTimer)
+	{
+		g_source_destroy(stateTimer);
+		stateTimer = 0;
+	}
+	send_pending = false;
+}
+
+void RtpWorker::sendStateDone(bool playing)
+{
+	stopSendWatch();
+
+	PendingCallback cb = pending_cb;
+	pending_cb = PendingNone;
+
+	bool ok;
+	if(playing)
+	{
+		ok = finishSend();
+	}
+	else
+	{
+#ifdef RTPWORKER_DEBUG
+		printf("error/timeout while setting send pipeline to PLAYING\n");
+#endif
+		cleanup();
+		error = RtpSessionContext::ErrorGeneric;
+		ok = false;
+	}
+
+	if(!ok)
+	{
+		if(cb != PendingNone && cb_error)
+			cb_error(app);
+		return;
+	}
+
+	applyActualPayloadInfo();
+
+	// PSI_AUDIO_RT is opt-in, so say how it went
+	if(!qgetenv("PSI_AUDIO_RT").isEmpty())
+		qWarning("psimedia: %d audio threads at raised priority%s", PipelineContext::raisedThreadCount(), PipelineContext::raiseDenied() ? ", raising was refused" : "");
+
+	if(cb == PendingStarted && cb_started)
+		cb_started(app);
+	else if(cb == PendingUpdated && cb_updated)
+		cb_updated(app);
 }
 
 bool RtpWorker::startRecv()
@@ -1222,6 +2111,7 @@ bool RtpWorker::startRecv()
 	}
 	if (samplerate != 16000) {
 	  cleanup();
+	  startSessions();
 	  startSend(samplerate);
 	}
 
@@ -1270,13 +2160,21 @@ bool RtpWorker::startRecv()
 
 		audiortpsrc_mutex.lock();
 		audiortpsrc = gst_element_factory_make("apprtpsrc", NULL);
+		audioInFilter->reset();
 		audiortpsrc_mutex.unlock();
 
 		GstCaps *caps = gst_caps_new_empty();
 		gst_caps_append_structure(caps, cs);
 		g_object_set(G_OBJECT(audiortpsrc), "caps", caps, NULL);
+		if(audiortpsrc_session)
+		{
+			g_object_set(G_OBJECT(audiortpsrc_session), "caps", caps, NULL);
+			set_rtpsrc_policy(audiortpsrc_session);
+		}
 		gst_caps_unref(caps);
 
+		set_rtpsrc_policy(audiortpsrc);
+
 		// FIXME: what if we don't have a name and just id?
 		//   it's okay, for now we only support speex which requires
 		//   the name..
@@ -1308,13 +2206,21 @@ bool RtpWorker::startRecv()
 
 		videortpsrc_mutex.lock();
 		videortpsrc = gst_element_factory_make("apprtpsrc", NULL);
+		videoInFilter->reset();
 		videortpsrc_mutex.unlock();
 
 		GstCaps *caps = gst_caps_new_empty();
 		gst_caps_append_structure(caps, cs);
 		g_object_set(G_OBJECT(videortpsrc), "caps", caps, NULL);
+		if(videortpsrc_session)
+		{
+			g_object_set(G_OBJECT(videortpsrc_session), "caps", caps, NULL);
+			set_rtpsrc_policy(videortpsrc_session);
+		}
 		gst_caps_unref(caps);
 
+		set_rtpsrc_policy(videortpsrc);
+
 		// FIXME: what if we don't have a name and just id?
 		//   it's okay, for now we only really support theora which
 		//   requires the name..
@@ -1337,6 +2243,9 @@ bool RtpWorker::startRecv()
 		if(!audiodec)
 			goto fail1;
 
+		PipelineContext::markAudioElement(audiortpsrc);
+		PipelineContext::markAudioElement(audiodec);
+
 		if(!aout.isEmpty())
 		{
 #ifdef RTPWORKER_DEBUG
@@ -1353,6 +2262,8 @@ bool RtpWorker::startRecv()
 			}
 
 			audioout = pd_audiosink->element();
+			if(pd_audiosrc)
+				pd_audiosrc->setEchoPlayback(pd_audiosink);
 		}
 		else
 			audioout = gst_element_factory_make("fakesink", NULL);
@@ -1378,10 +2289,15 @@ bool RtpWorker::startRecv()
 			gst_bin_add(GST_BIN(recvbin), audioout);
 
 		gst_element_link_many(audiortpsrc, audiodec, volumeout, audioconvert, audioresample, NULL);
+
 		if(!asrc)
 			gst_element_link(audioresample, audioout);
 
 		actual_remoteAudioPayloadInfo = remoteAudioPayloadInfo;
+
+		audiortpsrc_mutex.lock();
+		audioInFilter->setPayloadInfo(actual_remoteAudioPayloadInfo);
+		audiortpsrc_mutex.unlock();
 	}
 
 	if(videortpsrc)
@@ -1390,6 +2306,9 @@ bool RtpWorker::startRecv()
 		if(!videodec)
 			goto fail1;
 
+		PipelineContext::markVideoElement(videortpsrc);
+		PipelineContext::markVideoElement(videodec);
+
 		GstElement *videoconvert = gst_element_factory_make("ffmpegcolorspace", NULL);
 		GstElement *videosink = gst_element_factory_make("appvideosink", NULL);
 		GstAppVideoSink *appVideoSink = (GstAppVideoSink *)videosink;
@@ -1404,6 +2323,10 @@ bool RtpWorker::startRecv()
 		gst_element_link_many(videortpsrc, videodec, videoconvert, videosink, NULL);
 
 		actual_remoteVideoPayloadInfo = remoteVideoPayloadInfo;
+
+		videortpsrc_mutex.lock();
+		videoInFilter->setPayloadInfo(actual_remoteVideoPayloadInfo);
+		videortpsrc_mutex.unlock();
 	}
 
 	//gst_element_set_locked_state(recvbin, TRUE);
@@ -1431,10 +2354,40 @@ bool RtpWorker::startRecv()
 	printf("activating\n");
 #endif
 
-	gst_element_set_state(rpipeline, GST_STATE_READY);
-	gst_element_get_state(rpipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+	// going up to READY completes within set_state, so there is nothing
+	//   to wait for
+	if(gst_element_set_state(rpipeline, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE)
+	{
+#ifdef RTPWORKER_DEBUG
+		printf("failed to set receive pipeline to READY\n");
+#endif
+		// recvbin is in the pipeline already, so tear down all the way
+		cleanup();
+		error = RtpSessionContext::ErrorGeneric;
+		return false;
+	}
+
+	{
+		GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(rpipeline));
+		GstMessage *msg;
+		while((msg = gst_bus_pop(bus)) != NULL)
+			gst_message_unref(msg);
+
+		recv_pipelineContext->activate();
 
-	recv_pipelineContext->activate();
+		// PLAYING completes only once packets arrive, which doesn't
+		//   hold up starting.  errors in the meantime are reported
+		recvStateWatch = gst_bus_create_watch(bus);
+		g_source_set_callback(recvStateWatch, (GSourceFunc)cb_recvBusCall, this, NULL);
+		g_source_attach(recvStateWatch, mainContext_);
+
+		recvStateTimer = g_timeout_source_new(startTimeout);
+		g_source_set_callback(recvStateTimer, cb_recvTimeout, this, NULL);
+		g_source_attach(recvStateTimer, mainContext_);
+
+		gst_bus_post(bus, gst_message_new_application(GST_OBJECT(rpipeline), gst_structure_empty_new("psi-check-state")));
+		gst_object_unref(bus);
+	}
 
 	/*if(!shared_clock && use_shared_clock)
 	{
@@ -1473,6 +2426,8 @@ fail1:
 		recvbin = 0;
 	}
 
+	if(pd_audiosrc)
+		pd_audiosrc->setEchoPlayback(0);
 	delete pd_audiosink;
 	pd_audiosink = 0;
 
@@ -1525,12 +2480,21 @@ bool RtpWorker::addAudioChain(int rate)
 		g_object_set(G_OBJECT(volumein), "volume", vol, NULL);
 	}
 
+	// with a session, what we send goes out through it
 	GstElement *audiortpsink = gst_element_factory_make("apprtpsink", NULL);
 	GstAppRtpSink *appRtpSink = (GstAppRtpSink *)audiortpsink;
 	if(!fileDemux)
 		g_object_set(G_OBJECT(appRtpSink), "sync", FALSE, NULL);
-	appRtpSink->appdata = this;
-	appRtpSink->packet_ready = cb_packet_ready_rtp_audio;
+	if(audioSession)
+	{
+		appRtpSink->appdata = audioSession;
+		appRtpSink->packets_ready = stream_session_send;
+	}
+	else
+	{
+		appRtpSink->appdata = this;
+		appRtpSink->packets_ready = cb_packets_ready_rtp_audio;
+	}
 
 	GstElement *queue = 0;
 	if(fileDemux)
@@ -1594,10 +2558,7 @@ bool RtpWorker::addVideoChain()
 		}
 	}
 
-	int videokbps = maxbitrate;
-	// NOTE: we assume audio takes 45kbps
-	if(audiortppay)
-		videokbps -= 45;
+	int videokbps = videoKbps();
 
 	GstElement *videoprep = bins_videoprep_create(size, fps, fileDemux ? false : true);
 	if(!videoprep)
@@ -1620,12 +2581,40 @@ bool RtpWorker::addVideoChain()
 	appVideoSink->show_frame = cb_show_frame_preview;
 
 	GstElement *rtpqueue = gst_element_factory_make("queue", NULL);
+
+	// preview conversion and encoding run on these queues' threads
+	PipelineContext::markVideoElement(playqueue);
+	PipelineContext::markVideoElement(rtpqueue);
+
+	// keyframes come out of the payloader as a burst of packets, so
+	//   spread them out to the rate we're allowed to send at
+	GstElement *pacer = pacer_create(videokbps);
+
+	// see addAudioChain()
 	GstElement *videortpsink = gst_element_factory_make("apprtpsink", NULL);
 	GstAppRtpSink *appRtpSink = (GstAppRtpSink *)videortpsink;
 	if(!fileDemux)
 		g_object_set(G_OBJECT(appRtpSink), "sync", FALSE, NULL);
-	appRtpSink->appdata = this;
-	appRtpSink->packet_ready = cb_packet_ready_rtp_video;
+	if(videoSession)
+	{
+		appRtpSink->appdata = videoSession;
+		appRtpSink->packets_ready = stream_session_send;
+	}
+	else
+	{
+		appRtpSink->appdata = this;
+		appRtpSink->packets_ready = cb_packets_ready_rtp_video;
+	}
+
+	// the pacer already batches what it can, and collecting frames
+	//   after it would undo the pacing.  the session passes packets on
+	//   one at a time, so its sink collects them again
+	if(!pacer)
+	{
+		appRtpSink->collect_frames = TRUE;
+		if(videoSession)
+			((GstAppRtpSink *)videoSession->sendsink)->collect_frames = TRUE;
+	}
 
 	GstElement *queue = 0;
 	if(fileDemux)
@@ -1641,13 +2630,23 @@ bool RtpWorker::addVideoChain()
 	gst_bin_add(GST_BIN(sendbin), videoplaysink);
 	gst_bin_add(GST_BIN(sendbin), rtpqueue);
 	gst_bin_add(GST_BIN(sendbin), videoenc);
+	if(pacer)
+		gst_bin_add(GST_BIN(sendbin), pacer);
 	gst_bin_add(GST_BIN(sendbin), videortpsink);
 
 	gst_element_link(videoprep, videotee);
 	gst_element_link_many(videotee, playqueue, videoconvertplay, videoplaysink, NULL);
-	gst_element_link_many(videotee, rtpqueue, videoenc, videortpsink, NULL);
+
+	// the pacer goes right after the payloader, so that the session
+	//   sees packets at the time they are actually sent
+	gst_element_link_many(videotee, rtpqueue, videoenc, NULL);
+	if(pacer)
+		gst_element_link_many(videoenc, pacer, videortpsink, NULL);
+	else
+		gst_element_link(videoenc, videortpsink);
 
 	videortppay = videoenc;
+	videopacer = pacer;
 
 	if(fileDemux)
 	{
@@ -1661,6 +2660,8 @@ bool RtpWorker::addVideoChain()
 		gst_element_set_state(videoplaysink, GST_STATE_PAUSED);
 		gst_element_set_state(rtpqueue, GST_STATE_PAUSED);
 		gst_element_set_state(videoenc, GST_STATE_PAUSED);
+		if(pacer)
+			gst_element_set_state(pacer, GST_STATE_PAUSED);
 		gst_element_set_state(videortpsink, GST_STATE_PAUSED);
 
 		gst_element_link(videosrc, queue);
@@ -1676,6 +2677,15 @@ bool RtpWorker::addVideoChain()
 	return true;
 }
 
+int RtpWorker::videoKbps() const
+{
+	int kbps = maxbitrate;
+	// NOTE: we assume audio takes 45kbps
+	if(audiortppay)
+		kbps -= 45;
+	return kbps;
+}
+
 bool RtpWorker::getCaps()
 {
 	if(audiortppay)
@@ -31,9 +31,12 @@
 
 namespace PsiMedia {
 
+class PipelineContext;
 class PipelineDeviceContext;
 
 class Stats;
+class RtpInFilter;
+class StreamSession;
 
 // Note: do not destruct this class during one of its callbacks
 class RtpWorker
@@ -63,6 +66,10 @@ public:
 	QList<PPayloadInfo> remoteVideoPayloadInfo;
 	int maxbitrate;
 
+	// how long to wait for the devices to start, in ms.  defaults to 6
+	//   seconds, or PSI_RTP_START_TIMEOUT if set
+	int startTimeout;
+
 	// read-only
 	bool canTransmitAudio;
 	bool canTransmitVideo;
@@ -84,6 +91,8 @@ public:
 	// the rtp input functions are safe to call from any thread
 	void rtpAudioIn(const PRtpPacket &packet);
 	void rtpVideoIn(const PRtpPacket &packet);
+	void rtpAudioIn(const QList<PRtpPacket> &packets);
+	void rtpVideoIn(const QList<PRtpPacket> &packets);
 
 	void setOutputVolume(int level);
 	void setInputVolume(int level);
@@ -109,6 +118,11 @@ public:
 	void (*cb_rtpAudioOut)(const PRtpPacket &packet, void *app);
 	void (*cb_rtpVideoOut)(const PRtpPacket &packet, void *app);
 
+	// if set, rtp packets produced together (e.g. the fragments of one
+	//   video frame) are delivered here in one call instead
+	void (*cb_rtpAudioOutBatch)(const QList<PRtpPacket> &packets, void *app);
+	void (*cb_rtpVideoOutBatch)(const QList<PRtpPacket> &packets, void *app);
+
 	 // empty record packet = EOF/error
 	void (*cb_recordData)(const QByteArray &packet, void *app);
 
@@ -116,6 +130,49 @@ private:
 	GMainContext *mainContext_;
 	GSource *timer;
 
+	// bringing up the send pipeline is asynchronous, for devices as well
+	//   as for files (preroll).  meanwhile, stateWatch watches its bus for
+	//   the pipeline to reach PLAYING, stateTimer bounds the wait, and
+	//   pending_cb is what to report once it is done.
+	//
+	// the receive pipeline only completes PLAYING once packets arrive,
+	//   so starting doesn't wait for it.  instead recvStateWatch reports
+	//   errors from it until it is playing or recvStateTimer expires
+	enum PendingCallback
+	{
+		PendingNone,
+		PendingStarted,
+		PendingUpdated
+	};
+
+	GSource *stateWatch;
+	GSource *stateTimer;
+	bool send_pending;
+	PendingCallback pending_cb;
+	GSource *recvStateWatch;
+	GSource *recvStateTimer;
+
+	// each worker has pipelines of its own, so that any number of
+	//   sessions can send and receive at once.  the receive pipeline
+	//   follows the clock of the send pipeline.  devices are not shared
+	//   between workers though: concurrent sessions open the same device
+	//   once each, which fails for devices that allow only one opening
+	//   (this is warned about, see pipeline.cpp).  each worker pairs the
+	//   echo canceller of its own capture and playback devices
+	PipelineContext *send_pipelineContext, *recv_pipelineContext;
+	GstElement *spipeline, *rpipeline;
+	bool send_in_use, recv_in_use;
+
+	// the rtp sessions of the streams, built before sending or receiving
+	//   starts, in a pipeline of their own
+	PipelineContext *session_pipelineContext;
+	GstElement *sesspipeline;
+	StreamSession *audioSession, *videoSession;
+	bool session_in_use;
+	bool use_shared_clock;
+	GstClock *shared_clock;
+	bool send_clock_is_shared;
+
 	PipelineDeviceContext *pd_audiosrc, *pd_videosrc, *pd_audiosink;
 	GstElement *sendbin, *recvbin;
 
@@ -126,12 +183,19 @@ private:
 	GstElement *videortpsrc;
 	GstElement *audiortppay;
 	GstElement *videortppay;
+	GstElement *videopacer;
+	GstElement *audiortcpsrc;
+	GstElement *videortcpsrc;
+	GstElement *audiortpsrc_session; // incoming rtp goes here, if set
+	GstElement *videortpsrc_session;
 	GstElement *volumein;
 	GstElement *volumeout;
 	bool rtpaudioout;
 	bool rtpvideoout;
 	QMutex audiortpsrc_mutex;
 	QMutex videortpsrc_mutex;
+	QMutex audiortcpsrc_mutex;
+	QMutex videortcpsrc_mutex;
 	QMutex volumein_mutex;
 	QMutex volumeout_mutex;
 	QMutex rtpaudioout_mutex;
@@ -147,6 +211,10 @@ private:
 	Stats *audioStats;
 	Stats *videoStats;
 
+	// protected by the audiortpsrc/videortpsrc mutexes
+	RtpInFilter *audioInFilter;
+	RtpInFilter *videoInFilter;
+
 	void cleanup();
 
 	static gboolean cb_doStart(gpointer data);
@@ -158,9 +226,15 @@ private:
 	static gboolean cb_bus_call(GstBus *bus, GstMessage *msg, gpointer data);
 	static void cb_show_frame_preview(int width, int height, const unsigned char *rgb32, gpointer data);
 	static void cb_show_frame_output(int width, int height, const unsigned char *rgb32, gpointer data);
-	static void cb_packet_ready_rtp_audio(const unsigned char *buf, int size, gpointer data);
-	static void cb_packet_ready_rtp_video(const unsigned char *buf, int size, gpointer data);
+	static void cb_packets_ready_rtp_audio(GstBuffer **bufs, int count, gpointer data);
+	static void cb_packets_ready_rtp_video(GstBuffer **bufs, int count, gpointer data);
+	static void cb_packet_ready_rtcp_audio(GstBuffer *buf, gpointer data);
+	static void cb_packet_ready_rtcp_video(GstBuffer *buf, gpointer data);
 	static gboolean cb_fileReady(gpointer data);
+	static gboolean cb_sendBusCall(GstBus *bus, GstMessage *msg, gpointer data);
+	static gboolean cb_sendTimeout(gpointer data);
+	static gboolean cb_recvBusCall(GstBus *bus, GstMessage *msg, gpointer data);
+	static gboolean cb_recvTimeout(gpointer data);
 
 	gboolean doStart();
 	gboolean doUpdate();
@@ -171,17 +245,32 @@ private:
 	gboolean bus_call(GstBus *bus, GstMessage *msg);
 	void show_frame_preview(int width, int height, const unsigned char *rgb32);
 	void show_frame_output(int width, int height, const unsigned char *rgb32);
-	void packet_ready_rtp_audio(const unsigned char *buf, int size);
-	void packet_ready_rtp_video(const unsigned char *buf, int size);
+	void packets_ready_rtp_audio(GstBuffer **bufs, int count);
+	void packets_ready_rtp_video(GstBuffer **bufs, int count);
+	void packet_ready_rtcp_audio(GstBuffer *buf);
+	void packet_ready_rtcp_video(GstBuffer *buf);
 	gboolean fileReady();
+	gboolean sendBusCall(GstMessage *msg);
+	gboolean sendTimeout();
+	void stopSendWatch();
+	void sendStateDone(bool playing);
+	gboolean recvBusCall(GstMessage *msg);
+	gboolean recvTimeout();
+	void recvFailed();
+	void stopRecvWatch();
 
+	void startSessions();
+	void stopSessions();
 	bool setupSendRecv();
 	bool startSend();
 	bool startSend(int rate);
+	bool finishSend();
+	void applyActualPayloadInfo();
 	bool startRecv();
 	bool addAudioChain();
 	bool addAudioChain(int rate);
 	bool addVideoChain();
+	int videoKbps() const;
 	bool getCaps();
 	bool updateTheoraConfig();
 };
@@ -26,68 +26,49 @@
 
 // note: queuing frames doesn't really make much sense, since if the UI
 //   receives 5 frames at once, they'll just get painted on each other in
-//   succession and you'd only really see the last one.  however, we'll queue
-//   frames in case we ever want to do timestamped frames.
-#define QUEUE_FRAME_MAX 10
+//   succession and you'd only really see the last one.  so only the latest
+//   frame of each type is kept.
+
+// no intensity waiting to be delivered (real values are -1 to 100)
+#define INTENSITY_NONE -2
+
+// status messages make up most of the traffic, so recycle memory blocks
+//   of that size.  the rarer, bigger messages bypass the cache
+#define MESSAGE_POOL_SIZE 32
 
 namespace PsiMedia {
 
-static int queuedFrameInfo(const QList<RwControlMessage*> &list, RwControlFrame::Type type, int *firstPos)
+static PBlockCache<sizeof(RwControlStatusMessage), MESSAGE_POOL_SIZE> message_pool;
+
+void *RwControlMessage::operator new(size_t size)
 {
-	int count = 0;
-	bool first = true;
-	for(int n = 0; n < list.count(); ++n)
-	{
-		const RwControlMessage *msg = list[n];
-		if(msg->type == RwControlMessage::Frame && ((RwControlFrameMessage *)msg)->frame.type == type)
-		{
-			if(first)
-				*firstPos = n;
-			++count;
-			first = false;
-		}
-	}
-	return count;
+	return message_pool.alloc(size);
 }
 
-static RwControlFrameMessage *getLatestFrameAndRemoveOthers(QList<RwControlMessage*> *list, RwControlFrame::Type type)
+void RwControlMessage::operator delete(void *p, size_t size)
 {
-	RwControlFrameMessage *fmsg = 0;
-	for(int n = 0; n < list->count(); ++n)
-	{
-		RwControlMessage *msg = list->at(n);
-		if(msg->type == RwControlMessage::Frame && ((RwControlFrameMessage *)msg)->frame.type == type)
-		{
-			// if we already had a frame, discard it and take the next
-			if(fmsg)
-				delete fmsg;
-
-			fmsg = (RwControlFrameMessage *)msg;
-			list->removeAt(n);
-			--n; // adjust position
-		}
-	}
-	return fmsg;
+	message_pool.free(p, size);
 }
 
-static RwControlAudioIntensityMessage *getLatestAudioIntensityAndRemoveOthers(QList<RwControlMessage*> *list, RwControlAudioIntensity::Type type)
+// old glib has no atomic exchange
+static gpointer atomic_pointer_exchange(volatile gpointer *p, gpointer val)
 {
-	RwControlAudioIntensityMessage *amsg = 0;
-	for(int n = 0; n < list->count(); ++n)
+	gpointer old;
+	do
 	{
-		RwControlMessage *msg = list->at(n);
-		if(msg->type == RwControlMessage::AudioIntensity && ((RwControlAudioIntensityMessage *)msg)->intensity.type == type)
-		{
-			// if we already had a msg, discard it and take the next
-			if(amsg)
-				delete amsg;
+		old = g_atomic_pointer_get(p);
+	} while(!g_atomic_pointer_compare_and_exchange(p, old, val));
+	return old;
+}
 
-			amsg = (RwControlAudioIntensityMessage *)msg;
-			list->removeAt(n);
-			--n; // adjust position
-		}
-	}
-	return amsg;
+static gint atomic_int_exchange(volatile gint *p, gint val)
+{
+	gint old;
+	do
+	{
+		old = g_atomic_int_get(p);
+	} while(!g_atomic_int_compare_and_exchange(p, old, val));
+	return old;
 }
 
 static void simplifyQueue(QList<RwControlMessage*> *list)
@@ -106,8 +87,8 @@ static void simplifyQueue(QList<RwControlMessage*> *list)
 	// if there is, remove all messages after it
 	if(at != -1)
 	{
-		for(int n = at + 1; n < list->count();)
-			list->removeAt(n);
+		while(list->count() > at + 1)
+			delete list->takeLast();
 	}
 }
 
@@ -149,6 +130,77 @@ static void applyCodecsToWorker(RtpWorker *worker, const RwControlConfigCodecs &
 	worker->maxbitrate = codecs.maximumSendingBitrate;
 }
 
+//----------------------------------------------------------------------------
+// RwControlMessageQueue
+//----------------------------------------------------------------------------
+RwControlMessageQueue::RwControlMessageQueue() :
+	stub((RwControlMessage::Type)-1)
+{
+	head = &stub;
+	tail = &stub;
+}
+
+RwControlMessageQueue::~RwControlMessageQueue()
+{
+	RwControlMessage *msg;
+	while((msg = pop()))
+		delete msg;
+}
+
+void RwControlMessageQueue::push(RwControlMessage *msg)
+{
+	g_atomic_pointer_set(&msg->next, NULL);
+	RwControlMessage *prev = (RwControlMessage *)atomic_pointer_exchange(&head, msg);
+
+	// between the exchange and here, the message is in the queue but
+	//   can't be reached by pop() yet
+	g_atomic_pointer_set(&prev->next, msg);
+}
+
+RwControlMessage *RwControlMessageQueue::pop()
+{
+	RwControlMessage *t = tail;
+	RwControlMessage *next = (RwControlMessage *)g_atomic_pointer_get(&t->next);
+
+	// skip over the stub
+	if(t == &stub)
+	{
+		if(!next)
+			return 0;
+		tail = next;
+		t = next;
+		next = (RwControlMessage *)g_atomic_pointer_get(&t->next);
+	}
+
+	if(next)
+	{
+		tail = next;
+		return t;
+	}
+
+	// a push is in progress
+	if(t != (RwControlMessage *)g_atomic_pointer_get(&head))
+		return 0;
+
+	// t is the last message.  put the stub back behind it, so that
+	//   taking t doesn't leave the queue without a node
+	push(&stub);
+
+	next = (RwControlMessage *)g_atomic_pointer_get(&t->next);
+	if(next)
+	{
+		tail = next;
+		return t;
+	}
+
+	return 0;
+}
+
+bool RwControlMessageQueue::isEmpty()
+{
+	return (tail == &stub && !g_atomic_pointer_get(&stub.next));
+}
+
 //----------------------------------------------------------------------------
 // RwControlLocal
 //----------------------------------------------------------------------------
@@ -157,30 +209,37 @@ RwControlLocal::RwControlLocal(GstThread *thread, QObject *parent) :
 	app(0),
 	cb_rtpAudioOut(0),
 	cb_rtpVideoOut(0),
+	cb_rtpAudioOutBatch(0),
+	cb_rtpVideoOutBatch(0),
 	cb_recordData(0),
-	wake_pending(false)
+	wake_pending(0)
 {
 	thread_ = thread;
 	remote_ = 0;
 
-	// create RwControlRemote, block until ready
-	QMutexLocker locker(&m);
-	timer = g_timeout_source_new(0);
-	g_source_set_callback(timer, cb_doCreateRemote, this, NULL);
-	g_source_attach(timer, thread_->mainContext());
-	w.wait(&m);
+	for(int n = 0; n < 2; ++n)
+	{
+		latest_frame[n] = 0;
+		latest_intensity[n] = INTENSITY_NONE;
+	}
+
+	// the remote doesn't touch the remote thread until a message is
+	//   posted, so there is no need to wait on that thread here
+	remote_ = new RwControlRemote(thread_->mainContext(), this);
 }
 
 RwControlLocal::~RwControlLocal()
 {
-	// delete RwControlRemote, block until done
-	QMutexLocker locker(&m);
-	timer = g_timeout_source_new(0);
-	g_source_set_callback(timer, cb_doDestroyRemote, this, NULL);
+	// RwControlRemote must be deleted in the remote thread.  cut it off
+	//   from us and hand it over, rather than waiting for that thread
+	remote_->detach();
+	GSource *timer = g_timeout_source_new(0);
+	g_source_set_callback(timer, cb_doDestroyRemote, remote_, NULL);
 	g_source_attach(timer, thread_->mainContext());
-	w.wait(&m);
+	remote_ = 0;
 
-	qDeleteAll(in);
+	for(int n = 0; n < 2; ++n)
+		delete (RwControlFrameMessage *)latest_frame[n];
 }
 
 void RwControlLocal::start(const RwControlConfigDevices &devices, const RwControlConfigCodecs &codecs)
@@ -235,110 +294,77 @@ void RwControlLocal::rtpVideoIn(const PRtpPacket &packet)
 	remote_->rtpVideoIn(packet);
 }
 
-// note: this is executed in the remote thread
-gboolean RwControlLocal::cb_doCreateRemote(gpointer data)
+void RwControlLocal::rtpAudioIn(const QList<PRtpPacket> &packets)
 {
-	return ((RwControlLocal *)data)->doCreateRemote();
+	remote_->rtpAudioIn(packets);
 }
 
-// note: this is executed in the remote thread
-gboolean RwControlLocal::doCreateRemote()
+void RwControlLocal::rtpVideoIn(const QList<PRtpPacket> &packets)
 {
-	QMutexLocker locker(&m);
-	timer = 0;
-	remote_ = new RwControlRemote(thread_->mainContext(), this);
-	w.wakeOne();
-	return FALSE;
+	remote_->rtpVideoIn(packets);
 }
 
 // note: this is executed in the remote thread
 gboolean RwControlLocal::cb_doDestroyRemote(gpointer data)
 {
-	return ((RwControlLocal *)data)->doDestroyRemote();
-}
-
-// note: this is executed in the remote thread
-gboolean RwControlLocal::doDestroyRemote()
-{
-	QMutexLocker locker(&m);
-	timer = 0;
-	delete remote_;
-	remote_ = 0;
-	w.wakeOne();
+	delete (RwControlRemote *)data;
 	return FALSE;
 }
 
 void RwControlLocal::processMessages()
 {
-	in_mutex.lock();
-	wake_pending = false;
-	QList<RwControlMessage*> list = in;
-	in.clear();
-	in_mutex.unlock();
+	// clear this first, so that anything posted from here on gets
+	//   another pass
+	g_atomic_int_set(&wake_pending, 0);
 
 	QPointer<QObject> self = this;
 
-	// we only care about the latest preview frame
+	// latest preview frame
 	RwControlFrameMessage *fmsg;
-	fmsg = getLatestFrameAndRemoveOthers(&list, RwControlFrame::Preview);
+	fmsg = (RwControlFrameMessage *)atomic_pointer_exchange(&latest_frame[RwControlFrame::Preview], 0);
 	if(fmsg)
 	{
 		QImage i = fmsg->frame.image;
 		delete fmsg;
 		emit previewFrame(i);
 		if(!self)
-		{
-			qDeleteAll(list);
 			return;
-		}
 	}
 
-	// we only care about the latest output frame
-	fmsg = getLatestFrameAndRemoveOthers(&list, RwControlFrame::Output);
+	// latest output frame
+	fmsg = (RwControlFrameMessage *)atomic_pointer_exchange(&latest_frame[RwControlFrame::Output], 0);
 	if(fmsg)
 	{
 		QImage i = fmsg->frame.image;
 		delete fmsg;
 		emit outputFrame(i);
 		if(!self)
-		{
-			qDeleteAll(list);
 			return;
-		}
 	}
 
-	// we only care about the latest audio output intensity
-	RwControlAudioIntensityMessage *amsg = getLatestAudioIntensityAndRemoveOthers(&list, RwControlAudioIntensity::Output);
-	if(amsg)
+	// latest audio output intensity
+	int i = atomic_int_exchange(&latest_intensity[RwControlAudioIntensity::Output], INTENSITY_NONE);
+	if(i != INTENSITY_NONE)
 	{
-		int i = amsg->intensity.value;
-		delete amsg;
 		emit audioOutputIntensityChanged(i);
 		if(!self)
-		{
-			qDeleteAll(list);
 			return;
-		}
 	}
 
-	// we only care about the latest audio input intensity
-	amsg = getLatestAudioIntensityAndRemoveOthers(&list, RwControlAudioIntensity::Input);
-	if(amsg)
+	// latest audio input intensity
+	i = atomic_int_exchange(&latest_intensity[RwControlAudioIntensity::Input], INTENSITY_NONE);
+	if(i != INTENSITY_NONE)
 	{
-		int i = amsg->intensity.value;
-		delete amsg;
 		emit audioInputIntensityChanged(i);
 		if(!self)
-		{
-			qDeleteAll(list);
 			return;
-		}
 	}
 
-	// process the remaining messages
-	while(!list.isEmpty())
+	// process the queued messages.  if we get deleted along the way,
+	//   whatever is left is freed with the queue
+	RwControlMessage *msg;
+	while((msg = in.pop()))
 	{
-		RwControlMessage *msg = list.takeFirst();
 		if(msg->type == RwControlMessage::Status)
 		{
 			RwControlStatusMessage *smsg = (RwControlStatusMessage *)msg;
@@ -346,37 +372,42 @@ void RwControlLocal::processMessages()
 			delete smsg;
 			emit statusReady(status);
 			if(!self)
-			{
-				qDeleteAll(list);
 				return;
-			}
 		}
 		else
 			delete msg;
 	}
 }
 
+// note: this may be called from the remote thread
+void RwControlLocal::wake()
+{
+	// only queue one call per eventloop pass
+	if(g_atomic_int_compare_and_exchange(&wake_pending, 0, 1))
+		QMetaObject::invokeMethod(this, "processMessages", Qt::QueuedConnection);
+}
+
 // note: this may be called from the remote thread
 void RwControlLocal::postMessage(RwControlMessage *msg)
 {
-	QMutexLocker locker(&in_mutex);
+	in.push(msg);
+	wake();
+}
 
-	// if this is a frame, and the queue is maxed, then bump off the
-	//   oldest frame to make room
-	if(msg->type == RwControlMessage::Frame)
-	{
-		RwControlFrameMessage *fmsg = (RwControlFrameMessage *)msg;
-		int firstPos = -1;
-		if(queuedFrameInfo(in, fmsg->frame.type, &firstPos) >= QUEUE_FRAME_MAX)
-			in.removeAt(firstPos);
-	}
+// note: this may be called from the remote thread
+void RwControlLocal::postFrame(RwControlFrameMessage *msg)
+{
+	// a frame still in the slot was never seen, and now never will be
+	RwControlFrameMessage *old = (RwControlFrameMessage *)atomic_pointer_exchange(&latest_frame[msg->frame.type], msg);
+	delete old;
+	wake();
+}
 
-	in += msg;
-	if(!wake_pending)
-	{
-		QMetaObject::invokeMethod(this, "processMessages", Qt::QueuedConnection);
-		wake_pending = true;
-	}
+// note: this may be called from the remote thread
+void RwControlLocal::postAudioIntensity(RwControlAudioIntensity::Type type, int value)
+{
+	g_atomic_int_set(&latest_intensity[type], value);
+	wake();
 }
 
 //----------------------------------------------------------------------------
@@ -386,10 +417,34 @@ RwControlRemote::RwControlRemote(GMainContext *mainContext, RwControlLocal *loca
 	timer(0),
 	start_requested(false),
 	blocking(false),
-	pending_status(false)
+	pending_status(false),
+	local_calls(0),
+	detached(0),
+	worker(0),
+	worker_in(0)
 {
 	mainContext_ = mainContext;
 	local_ = local;
+}
+
+RwControlRemote::~RwControlRemote()
+{
+	m.lock();
+	if(timer)
+	{
+		g_source_destroy(timer);
+		timer = 0;
+	}
+	m.unlock();
+
+	delete worker;
+
+	qDeleteAll(in);
+}
+
+// note: this is executed in the remote thread
+void RwControlRemote::createWorker()
+{
 	worker = new RtpWorker(mainContext_);
 	worker->app = this;
 	worker->cb_started = cb_worker_started;
@@ -403,14 +458,10 @@ RwControlRemote::RwControlRemote(GMainContext *mainContext, RwControlLocal *loca
 	worker->cb_outputFrame = cb_worker_outputFrame;
 	worker->cb_rtpAudioOut = cb_worker_rtpAudioOut;
 	worker->cb_rtpVideoOut = cb_worker_rtpVideoOut;
+	worker->cb_rtpAudioOutBatch = cb_worker_rtpAudioOutBatch;
+	worker->cb_rtpVideoOutBatch = cb_worker_rtpVideoOutBatch;
 	worker->cb_recordData = cb_worker_recordData;
-}
-
-RwControlRemote::~RwControlRemote()
-{
-	delete worker;
-
-	qDeleteAll(in);
+	g_atomic_pointer_set(&worker_in, worker);
 }
 
 gboolean RwControlRemote::cb_processMessages(gpointer data)
@@ -473,6 +524,16 @@ void RwControlRemote::cb_worker_rtpVideoOut(const PRtpPacket &packet, void *app)
 	((RwControlRemote *)app)->worker_rtpVideoOut(packet);
 }
 
+void RwControlRemote::cb_worker_rtpAudioOutBatch(const QList<PRtpPacket> &packets, void *app)
+{
+	((RwControlRemote *)app)->worker_rtpAudioOutBatch(packets);
+}
+
+void RwControlRemote::cb_worker_rtpVideoOutBatch(const QList<PRtpPacket> &packets, void *app)
+{
+	((RwControlRemote *)app)->worker_rtpVideoOutBatch(packets);
+}
+
 void RwControlRemote::cb_worker_recordData(const QByteArray &packet, void *app)
 {
 	((RwControlRemote *)app)->worker_recordData(packet);
@@ -484,21 +545,24 @@ gboolean RwControlRemote::processMessages()
 	timer = 0;
 	m.unlock();
 
+	if(!worker)
+		createWorker();
+
 	while(1)
 	{
-		m.lock();
+		// pick up anything newly posted
+		RwControlMessage *msg;
+		while((msg = in_queue.pop()))
+			in += msg;
+
 		if(in.isEmpty())
-		{
-			m.unlock();
 			break;
-		}
 
 		// if there is a stop message in the queue, remove all others
 		//   because they are unnecessary
 		simplifyQueue(&in);
 
-		RwControlMessage *msg = in.takeFirst();
-		m.unlock();
+		msg = in.takeFirst();
 
 		bool ret = processMessage(msg);
 		delete msg;
@@ -551,7 +615,7 @@ bool RwControlRemote::processMessage(RwControlMessage *msg)
 			//   with the worker.
 			RwControlStatusMessage *msg = new RwControlStatusMessage;
 			msg->status.stopped = true;
-			local_->postMessage(msg);
+			postStatus(msg);
 		}
 
 		return false;
@@ -606,7 +670,7 @@ void RwControlRemote::worker_started()
 {
 	pending_status = false;
 	RwControlStatusMessage *msg = statusFromWorker(worker);
-	local_->postMessage(msg);
+	postStatus(msg);
 	resumeMessages();
 }
 
@@ -617,7 +681,7 @@ void RwControlRemote::worker_updated()
 	{
 		pending_status = false;
 		RwControlStatusMessage *msg = statusFromWorker(worker);
-		local_->postMessage(msg);
+		postStatus(msg);
 	}
 
 	resumeMessages();
@@ -628,14 +692,14 @@ void RwControlRemote::worker_stopped()
 	pending_status = false;
 	RwControlStatusMessage *msg = statusFromWorker(worker);
 	msg->status.stopped = true;
-	local_->postMessage(msg);
+	postStatus(msg);
 }
 
 void RwControlRemote::worker_finished()
 {
 	RwControlStatusMessage *msg = statusFromWorker(worker);
 	msg->status.finished = true;
-	local_->postMessage(msg);
+	postStatus(msg);
 }
 
 void RwControlRemote::worker_error()
@@ -643,57 +707,100 @@ void RwControlRemote::worker_error()
 	RwControlStatusMessage *msg = statusFromWorker(worker);
 	msg->status.error = true;
 	msg->status.errorCode = worker->error;
-	local_->postMessage(msg);
+	postStatus(msg);
 }
 
 void RwControlRemote::worker_audioOutputIntensity(int value)
 {
-	RwControlAudioIntensityMessage *msg = new RwControlAudioIntensityMessage;
-	msg->intensity.type = RwControlAudioIntensity::Output;
-	msg->intensity.value = value;
-	local_->postMessage(msg);
+	if(!enterLocal())
+		return;
+	local_->postAudioIntensity(RwControlAudioIntensity::Output, value);
+	leaveLocal();
 }
 
 void RwControlRemote::worker_audioInputIntensity(int value)
 {
-	RwControlAudioIntensityMessage *msg = new RwControlAudioIntensityMessage;
-	msg->intensity.type = RwControlAudioIntensity::Input;
-	msg->intensity.value = value;
-	local_->postMessage(msg);
+	if(!enterLocal())
+		return;
+	local_->postAudioIntensity(RwControlAudioIntensity::Input, value);
+	leaveLocal();
 }
 
 void RwControlRemote::worker_previewFrame(const RtpWorker::Frame &frame)
 {
+	if(!enterLocal())
+		return;
 	RwControlFrameMessage *msg = new RwControlFrameMessage;
 	msg->frame.type = RwControlFrame::Preview;
 	msg->frame.image = frame.image;
-	local_->postMessage(msg);
+	local_->postFrame(msg);
+	leaveLocal();
 }
 
 void RwControlRemote::worker_outputFrame(const RtpWorker::Frame &frame)
 {
+	if(!enterLocal())
+		return;
 	RwControlFrameMessage *msg = new RwControlFrameMessage;
 	msg->frame.type = RwControlFrame::Output;
 	msg->frame.image = frame.image;
-	local_->postMessage(msg);
+	local_->postFrame(msg);
+	leaveLocal();
 }
 
 void RwControlRemote::worker_rtpAudioOut(const PRtpPacket &packet)
 {
+	if(!enterLocal())
+		return;
 	if(local_->cb_rtpAudioOut)
 		local_->cb_rtpAudioOut(packet, local_->app);
+	leaveLocal();
 }
 
 void RwControlRemote::worker_rtpVideoOut(const PRtpPacket &packet)
 {
+	if(!enterLocal())
+		return;
 	if(local_->cb_rtpVideoOut)
 		local_->cb_rtpVideoOut(packet, local_->app);
+	leaveLocal();
+}
+
+void RwControlRemote::worker_rtpAudioOutBatch(const QList<PRtpPacket> &packets)
+{
+	if(!enterLocal())
+		return;
+	if(local_->cb_rtpAudioOutBatch)
+		local_->cb_rtpAudioOutBatch(packets, local_->app);
+	else if(local_->cb_rtpAudioOut)
+	{
+		foreach(const PRtpPacket &packet, packets)
+			local_->cb_rtpAudioOut(packet, local_->app);
+	}
+	leaveLocal();
+}
+
+void RwControlRemote::worker_rtpVideoOutBatch(const QList<PRtpPacket> &packets)
+{
+	if(!enterLocal())
+		return;
+	if(local_->cb_rtpVideoOutBatch)
+		local_->cb_rtpVideoOutBatch(packets, local_->app);
+	else if(local_->cb_rtpVideoOut)
+	{
+		foreach(const PRtpPacket &packet, packets)
+			local_->cb_rtpVideoOut(packet, local_->app);
+	}
+	leaveLocal();
 }
 
 void RwControlRemote::worker_recordData(const QByteArray &packet)
 {
+	if(!enterLocal())
+		return;
 	if(local_->cb_recordData)
 		local_->cb_recordData(packet, local_->app);
+	leaveLocal();
 }
 
 void RwControlRemote::resumeMessages()
@@ -702,7 +809,7 @@ void RwControlRemote::resumeMessages()
 	if(blocking)
 	{
 		blocking = false;
-		if(!in.isEmpty() && !timer)
+		if((!in.isEmpty() || !in_queue.isEmpty()) && !timer)
 		{
 			timer = g_timeout_source_new(0);
 			g_source_set_callback(timer, cb_processMessages, this, NULL);
@@ -711,9 +818,52 @@ void RwControlRemote::resumeMessages()
 	}
 }
 
+// note: this may be called from any thread
+bool RwControlRemote::enterLocal()
+{
+	g_atomic_int_inc(&local_calls);
+	if(g_atomic_int_get(&detached))
+	{
+		leaveLocal();
+		return false;
+	}
+	return true;
+}
+
+void RwControlRemote::leaveLocal()
+{
+	g_atomic_int_add(&local_calls, -1);
+}
+
+void RwControlRemote::postStatus(RwControlStatusMessage *msg)
+{
+	if(!enterLocal())
+	{
+		delete msg;
+		return;
+	}
+	local_->postMessage(msg);
+	leaveLocal();
+}
+
+// note: this is called from the local thread.  once it returns, local_
+//   is never touched again.  calls already in progress are short and
+//   never wait on anything, so this only ever spins briefly
+void RwControlRemote::detach()
+{
+	g_atomic_int_set(&detached, 1);
+	while(g_atomic_int_get(&local_calls) > 0)
+		g_thread_yield();
+}
+
 // note: this may be called from the local thread
 void RwControlRemote::postMessage(RwControlMessage *msg)
 {
+	// msg belongs to the remote thread once pushed
+	bool isStop = (msg->type == RwControlMessage::Stop);
+	in_queue.push(msg);
+
+	// the queue itself needs no lock, but the scheduling state does
 	QMutexLocker locker(&m);
 
 	// if a stop message is sent, unblock so that it can get processed.
@@ -721,11 +871,9 @@ void RwControlRemote::postMessage(RwControlMessage *msg)
 	//   starting.  note: care must be taken in the message handler, as
 	//   this will cause processing to resume before resumeMessages() has
 	//   been called.
-	if(msg->type == RwControlMessage::Stop)
+	if(isStop)
 		blocking = false;
 
-	in += msg;
-
 	if(!blocking && !timer)
 	{
 		timer = g_timeout_source_new(0);
@@ -737,13 +885,35 @@ void RwControlRemote::postMessage(RwControlMessage *msg)
 // note: this may be called from the local thread
 void RwControlRemote::rtpAudioIn(const PRtpPacket &packet)
 {
-	worker->rtpAudioIn(packet);
+	// nothing to feed until the worker exists
+	RtpWorker *w = (RtpWorker *)g_atomic_pointer_get(&worker_in);
+	if(w)
+		w->rtpAudioIn(packet);
 }
 
 // note: this may be called from the local thread
 void RwControlRemote::rtpVideoIn(const PRtpPacket &packet)
 {
-	worker->rtpVideoIn(packet);
+	// nothing to feed until the worker exists
+	RtpWorker *w = (RtpWorker *)g_atomic_pointer_get(&worker_in);
+	if(w)
+		w->rtpVideoIn(packet);
+}
+
+// note: this may be called from the local thread
+void RwControlRemote::rtpAudioIn(const QList<PRtpPacket> &packets)
+{
+	RtpWorker *w = (RtpWorker *)g_atomic_pointer_get(&worker_in);
+	if(w)
+		w->rtpAudioIn(packets);
+}
+
+// note: this may be called from the local thread
+void RwControlRemote::rtpVideoIn(const QList<PRtpPacket> &packets)
+{
+	RtpWorker *w = (RtpWorker *)g_atomic_pointer_get(&worker_in);
+	if(w)
+		w->rtpVideoIn(packets);
 }
 
 }
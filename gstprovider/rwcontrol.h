@@ -231,20 +231,27 @@ public:
 		Transmit,
 		Record,
 		Status,
-		AudioIntensity,
 		Frame
 	};
 
 	Type type;
 
+	// link for RwControlMessageQueue
+	volatile gpointer next;
+
 	RwControlMessage(Type _type) :
-		type(_type)
+		type(_type),
+		next(0)
 	{
 	}
 
 	virtual ~RwControlMessage()
 	{
 	}
+
+	// messages are recycled, see rwcontrol.cpp
+	static void *operator new(size_t size);
+	static void operator delete(void *p, size_t size);
 };
 
 class RwControlStartMessage : public RwControlMessage
@@ -323,17 +330,6 @@ public:
 	}
 };
 
-class RwControlAudioIntensityMessage : public RwControlMessage
-{
-public:
-	RwControlAudioIntensity intensity;
-
-	RwControlAudioIntensityMessage() :
-		RwControlMessage(RwControlMessage::AudioIntensity)
-	{
-	}
-};
-
 class RwControlFrameMessage : public RwControlMessage
 {
 public:
@@ -346,6 +342,33 @@ public:
 	}
 };
 
+// lock-free queue of messages, from any number of posting threads to a
+//   single receiving thread.  this is vyukov's intrusive mpsc queue: a
+//   push is one atomic exchange, and messages are linked through their
+//   own next field, so the queue never allocates
+class RwControlMessageQueue
+{
+public:
+	RwControlMessageQueue();
+	~RwControlMessageQueue(); // deletes anything left
+
+	// any thread
+	void push(RwControlMessage *msg);
+
+	// receiving thread only.  pop() returns 0 if the queue is empty, and
+	//   also if the next message is still in the middle of being pushed.
+	//   in that case the pusher has not yet woken the receiver, and will
+	RwControlMessage *pop();
+	bool isEmpty();
+
+private:
+	RwControlMessage stub;
+	volatile gpointer head; // most recently pushed
+	RwControlMessage *tail; // next to pop
+
+	Q_DISABLE_COPY(RwControlMessageQueue);
+};
+
 class RwControlLocal : public QObject
 {
 	Q_OBJECT
@@ -364,6 +387,8 @@ public:
 	// can be called from any thread
 	void rtpAudioIn(const PRtpPacket &packet);
 	void rtpVideoIn(const PRtpPacket &packet);
+	void rtpAudioIn(const QList<PRtpPacket> &packets);
+	void rtpVideoIn(const QList<PRtpPacket> &packets);
 
 	// can come from any thread.
 	// note that it is only safe to assign callbacks prior to starting.
@@ -372,6 +397,8 @@ public:
 	void *app;
 	void (*cb_rtpAudioOut)(const PRtpPacket &packet, void *app);
 	void (*cb_rtpVideoOut)(const PRtpPacket &packet, void *app);
+	void (*cb_rtpAudioOutBatch)(const QList<PRtpPacket> &packets, void *app); // optional
+	void (*cb_rtpVideoOutBatch)(const QList<PRtpPacket> &packets, void *app); // optional
 	void (*cb_recordData)(const QByteArray &packet, void *app);
 
 signals:
@@ -388,23 +415,25 @@ private slots:
 
 private:
 	GstThread *thread_;
-	GSource *timer;
-	QMutex m;
-	QWaitCondition w;
 	RwControlRemote *remote_;
-	bool wake_pending;
+	volatile gint wake_pending;
+
+	RwControlMessageQueue in;
 
-	QMutex in_mutex;
-	QList<RwControlMessage*> in;
+	// only the latest frame of each type, and the latest intensity of
+	//   each direction, are of any use.  rather than queuing these, the
+	//   remote side overwrites a slot for each
+	volatile gpointer latest_frame[2]; // RwControlFrameMessage*, by RwControlFrame::Type
+	volatile gint latest_intensity[2]; // by RwControlAudioIntensity::Type
 
-	static gboolean cb_doCreateRemote(gpointer data);
 	static gboolean cb_doDestroyRemote(gpointer data);
 
-	gboolean doCreateRemote();
-	gboolean doDestroyRemote();
+	void wake();
 
 	friend class RwControlRemote;
 	void postMessage(RwControlMessage *msg);
+	void postFrame(RwControlFrameMessage *msg);
+	void postAudioIntensity(RwControlAudioIntensity::Type type, int value);
 };
 
 class RwControlRemote
@@ -422,8 +451,17 @@ private:
 	bool blocking;
 	bool pending_status;
 
+	// calls into local_ are bracketed by enterLocal()/leaveLocal(), so
+	//   that the local side can let go of us without a round trip
+	volatile gint local_calls;
+	volatile gint detached;
+
+	// the worker is created on the remote thread, on first use.  worker
+	//   is for the remote thread, worker_in for feeding packets from others
 	RtpWorker *worker;
-	QList<RwControlMessage*> in;
+	volatile gpointer worker_in;
+	RwControlMessageQueue in_queue;
+	QList<RwControlMessage*> in; // taken from in_queue, remote thread only
 
 	static gboolean cb_processMessages(gpointer data);
 	static void cb_worker_started(void *app);
@@ -437,9 +475,12 @@ private:
 	static void cb_worker_outputFrame(const RtpWorker::Frame &frame, void *app);
 	static void cb_worker_rtpAudioOut(const PRtpPacket &packet, void *app);
 	static void cb_worker_rtpVideoOut(const PRtpPacket &packet, void *app);
+	static void cb_worker_rtpAudioOutBatch(const QList<PRtpPacket> &packets, void *app);
+	static void cb_worker_rtpVideoOutBatch(const QList<PRtpPacket> &packets, void *app);
 	static void cb_worker_recordData(const QByteArray &packet, void *app);
 
 	gboolean processMessages();
+	void createWorker();
 	void worker_started();
 	void worker_updated();
 	void worker_stopped();
@@ -451,17 +492,26 @@ private:
 	void worker_outputFrame(const RtpWorker::Frame &frame);
 	void worker_rtpAudioOut(const PRtpPacket &packet);
 	void worker_rtpVideoOut(const PRtpPacket &packet);
+	void worker_rtpAudioOutBatch(const QList<PRtpPacket> &packets);
+	void worker_rtpVideoOutBatch(const QList<PRtpPacket> &packets);
 	void worker_recordData(const QByteArray &packet);
 
 	void resumeMessages();
 
+	bool enterLocal();
+	void leaveLocal();
+	void postStatus(RwControlStatusMessage *msg);
+
 	// return false to block further message processing
 	bool processMessage(RwControlMessage *msg);
 
 	friend class RwControlLocal;
+	void detach();
 	void postMessage(RwControlMessage *msg);
 	void rtpAudioIn(const PRtpPacket &packet);
 	void rtpVideoIn(const PRtpPacket &packet);
+	void rtpAudioIn(const QList<PRtpPacket> &packets);
+	void rtpVideoIn(const QList<PRtpPacket> &packets);
 };
 
 }
@@ -20,8 +20,37 @@
 
 #include "psimedia.h"
 
+#include <string.h>
 #include <QCoreApplication>
 #include <QPluginLoader>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <QTime>
+#include <QPointer>
+#include <QHostAddress>
+
+#ifdef Q_OS_UNIX
+# include <errno.h>
+# include <fcntl.h>
+# include <poll.h>
+# include <stdlib.h>
+# include <unistd.h>
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <netinet/udp.h>
+# include <arpa/inet.h>
+#else
+# include <QUdpSocket>
+#endif
+
+#ifdef Q_OS_LINUX
+# define RTPTRANSPORT_MMSG
+# ifdef UDP_SEGMENT
+#  define RTPTRANSPORT_GSO
+# endif
+#endif
 
 #ifdef QT_GUI_LIB
 #include <QPainter>
@@ -708,19 +737,76 @@ QList<VideoParams> Features::supportedVideoModes()
 //----------------------------------------------------------------------------
 // RtpPacket
 //----------------------------------------------------------------------------
+// packets up to this size get their bytes from a recycled block
+#define RTPPACKET_BLOCK_SIZE 2048
+
+// maximum number of recycled objects of each kind held in reserve
+#define RTPPACKET_POOL_SIZE 256
+
 class RtpPacket::Private : public QSharedData
 {
 public:
 	QByteArray rawValue;
 	int portOffset;
+	QExplicitlySharedDataPointer<PRtpPacketData> owner;
 
 	Private(const QByteArray &_rawValue, int _portOffset) :
 		rawValue(_rawValue),
 		portOffset(_portOffset)
 	{
 	}
+
+	static void *operator new(size_t size);
+	static void operator delete(void *p, size_t size);
+};
+
+// fixed-capacity packet storage, for packets built from raw bytes
+class RtpPacketBlock : public PRtpPacketData
+{
+public:
+	char data[RTPPACKET_BLOCK_SIZE];
+
+	static void *operator new(size_t size);
+	static void operator delete(void *p, size_t size);
+};
+
+class RtpPacketPool
+{
+public:
+	static PBlockCache<sizeof(RtpPacket::Private), RTPPACKET_POOL_SIZE> privates;
+	static PBlockCache<sizeof(RtpPacketBlock), RTPPACKET_POOL_SIZE> blocks;
+	static PBlockCache<sizeof(RtpPacket), RTPPACKET_POOL_SIZE> nodes;
+
+	// QByteArray::fromRawData() allocates a header, which we can't
+	//   recycle, so these are only counted
+	static QBasicAtomicInt headers;
 };
 
+PBlockCache<sizeof(RtpPacket::Private), RTPPACKET_POOL_SIZE> RtpPacketPool::privates;
+PBlockCache<sizeof(RtpPacketBlock), RTPPACKET_POOL_SIZE> RtpPacketPool::blocks;
+PBlockCache<sizeof(RtpPacket), RTPPACKET_POOL_SIZE> RtpPacketPool::nodes;
+QBasicAtomicInt RtpPacketPool::headers = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+void *RtpPacket::Private::operator new(size_t size)
+{
+	return RtpPacketPool::privates.alloc(size);
+}
+
+void RtpPacket::Private::operator delete(void *p, size_t size)
+{
+	RtpPacketPool::privates.free(p, size);
+}
+
+void *RtpPacketBlock::operator new(size_t size)
+{
+	return RtpPacketPool::blocks.alloc(size);
+}
+
+void RtpPacketBlock::operator delete(void *p, size_t size)
+{
+	RtpPacketPool::blocks.free(p, size);
+}
+
 RtpPacket::RtpPacket() :
 	d(0)
 {
@@ -731,6 +817,20 @@ RtpPacket::RtpPacket(const QByteArray &rawValue, int portOffset) :
 {
 }
 
+RtpPacket::RtpPacket(const char *data, int size, int portOffset)
+{
+	if(size <= RTPPACKET_BLOCK_SIZE)
+	{
+		RtpPacketBlock *block = new RtpPacketBlock;
+		memcpy(block->data, data, size);
+		RtpPacketPool::headers.ref();
+		d = new Private(QByteArray::fromRawData(block->data, size), portOffset);
+		d->owner = block;
+	}
+	else
+		d = new Private(QByteArray(data, size), portOffset);
+}
+
 RtpPacket::RtpPacket(const RtpPacket &other) :
 	d(other.d)
 {
@@ -753,6 +853,12 @@ bool RtpPacket::isNull() const
 
 QByteArray RtpPacket::rawValue() const
 {
+	// if the bytes belong to the provider, we can't let them escape
+	//   without a copy, since the caller may hold onto the result
+	//   longer than the packet
+	if(d->owner)
+		return QByteArray(d->rawValue.constData(), d->rawValue.size());
+
 	return d->rawValue;
 }
 
@@ -761,10 +867,143 @@ int RtpPacket::portOffset() const
 	return d->portOffset;
 }
 
+const char *RtpPacket::constData() const
+{
+	if(!d)
+		return 0;
+	return d->rawValue.constData();
+}
+
+int RtpPacket::size() const
+{
+	if(!d)
+		return 0;
+	return d->rawValue.size();
+}
+
+// fixed part of the rtp header
+#define RTP_HEADER_SIZE 12
+
+static inline quint16 rtp_read16(const char *p)
+{
+	const unsigned char *u = (const unsigned char *)p;
+	return (quint16)((u[0] << 8) | u[1]);
+}
+
+static inline quint32 rtp_read32(const char *p)
+{
+	const unsigned char *u = (const unsigned char *)p;
+	return ((quint32)u[0] << 24) | ((quint32)u[1] << 16) | ((quint32)u[2] << 8) | (quint32)u[3];
+}
+
+bool RtpPacket::hasRtpHeader() const
+{
+	return (d && d->rawValue.size() >= RTP_HEADER_SIZE && ((unsigned char)d->rawValue.constData()[0] >> 6) == 2);
+}
+
+int RtpPacket::payloadType() const
+{
+	if(!hasRtpHeader())
+		return 0;
+	return (unsigned char)d->rawValue.constData()[1] & 0x7f;
+}
+
+bool RtpPacket::marker() const
+{
+	if(!hasRtpHeader())
+		return false;
+	return ((unsigned char)d->rawValue.constData()[1] & 0x80) ? true : false;
+}
+
+quint16 RtpPacket::sequence() const
+{
+	if(!hasRtpHeader())
+		return 0;
+	return rtp_read16(d->rawValue.constData() + 2);
+}
+
+quint32 RtpPacket::timestamp() const
+{
+	if(!hasRtpHeader())
+		return 0;
+	return rtp_read32(d->rawValue.constData() + 4);
+}
+
+quint32 RtpPacket::ssrc() const
+{
+	if(!hasRtpHeader())
+		return 0;
+	return rtp_read32(d->rawValue.constData() + 8);
+}
+
+const char *RtpPacket::payloadData() const
+{
+	if(payloadSize() <= 0)
+		return 0;
+
+	const char *p = d->rawValue.constData();
+	int offset = RTP_HEADER_SIZE + ((unsigned char)p[0] & 0x0f) * 4;
+	if((unsigned char)p[0] & 0x10)
+		offset += 4 + rtp_read16(p + offset + 2) * 4;
+	return p + offset;
+}
+
+int RtpPacket::payloadSize() const
+{
+	if(!hasRtpHeader())
+		return 0;
+
+	const char *p = d->rawValue.constData();
+	int size = d->rawValue.size();
+
+	// csrcs
+	int offset = RTP_HEADER_SIZE + ((unsigned char)p[0] & 0x0f) * 4;
+
+	// header extension
+	if((unsigned char)p[0] & 0x10)
+	{
+		if(offset + 4 > size)
+			return 0;
+		offset += 4 + rtp_read16(p + offset + 2) * 4;
+	}
+
+	// padding, the count is in the last byte
+	if((unsigned char)p[0] & 0x20)
+		size -= (unsigned char)p[size - 1];
+
+	if(offset > size)
+		return 0;
+	return size - offset;
+}
+
+int RtpPacket::allocatedCount()
+{
+	return RtpPacketPool::privates.allocatedCount() + RtpPacketPool::blocks.allocatedCount() + RtpPacketPool::nodes.allocatedCount() + RtpPacketPool::headers.fetchAndAddRelaxed(0);
+}
+
+int RtpPacket::recycledCount()
+{
+	return RtpPacketPool::privates.recycledCount() + RtpPacketPool::blocks.recycledCount() + RtpPacketPool::nodes.recycledCount();
+}
+
+void *RtpPacket::operator new(size_t size)
+{
+	return RtpPacketPool::nodes.alloc(size);
+}
+
+void RtpPacket::operator delete(void *p, size_t size)
+{
+	RtpPacketPool::nodes.free(p, size);
+}
+
 //----------------------------------------------------------------------------
 // RtpChannel
 //----------------------------------------------------------------------------
-class RtpChannelPrivate : public QObject
+RtpPacketSink::~RtpPacketSink()
+{
+}
+
+class RtpChannelPrivate : public QObject, public PRtpPacketSink
 {
 	Q_OBJECT
 
@@ -773,13 +1012,29 @@ public:
 	RtpChannelContext *c;
 	bool enabled;
 	int readyReadListeners;
+	QMutex sink_mutex;
+	RtpPacketSink *sink; // changed under sink_mutex
+	int queueSize;
+	int highWatermark;
+
+	// loopbacks and transports writing into this channel from other
+	//   threads.  they go through wc rather than c, so the context can
+	//   be swapped safely underneath them
+	int directWriters;
+	QMutex wc_mutex;
+	RtpChannelContext *wc;
 
 	RtpChannelPrivate(RtpChannel *_q) :
 		QObject(_q),
 		q(_q),
 		c(0),
 		enabled(false),
-		readyReadListeners(0)
+		readyReadListeners(0),
+		sink(0),
+		queueSize(-1),
+		highWatermark(-1),
+		directWriters(0),
+		wc(0)
 	{
 	}
 
@@ -787,6 +1042,12 @@ public:
 	{
 		if(c)
 		{
+			wc_mutex.lock();
+			wc = 0;
+			wc_mutex.unlock();
+
+			if(sink)
+				c->setPacketSink(0);
 			c->qobject()->disconnect(this);
 			c->qobject()->setParent(0);
 			enabled = false;
@@ -800,15 +1061,125 @@ public:
 		c->qobject()->setParent(this);
 		connect(c->qobject(), SIGNAL(readyRead()), SLOT(c_readyRead()));
 		connect(c->qobject(), SIGNAL(packetsWritten(int)), SLOT(c_packetsWritten(int)));
+		connect(c->qobject(), SIGNAL(packetsDropped(int)), SLOT(c_packetsDropped(int)));
+		connect(c->qobject(), SIGNAL(highWatermark(int)), SLOT(c_highWatermark(int)));
 		connect(c->qobject(), SIGNAL(destroyed()), SLOT(c_destroyed()));
 
-		if(readyReadListeners > 0)
+		if(queueSize != -1)
+			c->setQueueSize(queueSize);
+		if(highWatermark != -1)
+			c->setHighWatermark(highWatermark);
+
+		if(sink)
+			c->setPacketSink(this);
+
+		if(readyReadListeners > 0 || sink || directWriters > 0)
+		{
+			enabled = true;
+			c->setEnabled(true);
+		}
+
+		wc_mutex.lock();
+		wc = c;
+		wc_mutex.unlock();
+	}
+
+	void setSink(RtpPacketSink *_sink)
+	{
+		RtpPacketSink *old = sink;
+
+		// detach before clearing, so that the context stops calling us
+		if(c && old && !_sink)
+			c->setPacketSink(0);
+
+		// when switching sinks, this waits out any call into the old one
+		sink_mutex.lock();
+		sink = _sink;
+		sink_mutex.unlock();
+
+		if(!c)
+			return;
+
+		if(sink && !old)
+			c->setPacketSink(this);
+
+		bool want = (readyReadListeners > 0 || sink || directWriters > 0);
+		if(want != enabled)
+		{
+			enabled = want;
+			c->setEnabled(want);
+		}
+	}
+
+	static RtpPacket fromProvider(const PRtpPacket &pp)
+	{
+		RtpPacket p(pp.rawValue, pp.portOffset);
+		p.d->owner = pp.owner;
+		return p;
+	}
+
+	// note: this is executed from a different thread
+	virtual void packetReady(const PRtpPacket &packet)
+	{
+		QMutexLocker locker(&sink_mutex);
+		if(sink)
+			sink->packetReady(fromProvider(packet));
+	}
+
+	void addDirectWriter()
+	{
+		++directWriters;
+		if(c && !enabled)
 		{
 			enabled = true;
 			c->setEnabled(true);
 		}
 	}
 
+	void removeDirectWriter()
+	{
+		--directWriters;
+		if(c && enabled && readyReadListeners == 0 && !sink && directWriters == 0)
+		{
+			enabled = false;
+			c->setEnabled(false);
+		}
+	}
+
+	// note: this is executed from a different thread
+	void directWrite(const RtpPacket &rtp)
+	{
+		QMutexLocker locker(&wc_mutex);
+		if(!wc)
+			return;
+
+		PRtpPacket pp;
+		pp.rawValue = rtp.d->rawValue;
+		pp.portOffset = rtp.d->portOffset;
+		pp.owner = rtp.d->owner;
+		wc->write(pp);
+	}
+
+	// note: this is executed from a different thread
+	void directWrite(const QList<RtpPacket> &rtps)
+	{
+		QMutexLocker locker(&wc_mutex);
+		if(!wc)
+			return;
+
+		QList<PRtpPacket> pps;
+		pps.reserve(rtps.count());
+		foreach(const RtpPacket &rtp, rtps)
+		{
+			PRtpPacket pp;
+			pp.rawValue = rtp.d->rawValue;
+			pp.portOffset = rtp.d->portOffset;
+			pp.owner = rtp.d->owner;
+			pps += pp;
+		}
+		wc->writeBatch(pps);
+	}
+
 private slots:
 	void c_readyRead()
 	{
@@ -820,8 +1191,22 @@ private slots:
 		emit q->packetsWritten(count);
 	}
 
+	void c_packetsDropped(int count)
+	{
+		emit q->packetsDropped(count);
+	}
+
+	void c_highWatermark(int queued)
+	{
+		emit q->highWatermark(queued);
+	}
+
 	void c_destroyed()
 	{
+		wc_mutex.lock();
+		wc = 0;
+		wc_mutex.unlock();
+
 		enabled = false;
 		c = 0;
 	}
@@ -849,8 +1234,7 @@ RtpPacket RtpChannel::read()
 {
 	if(d->c)
 	{
-		PRtpPacket pp = d->c->read();
-		return RtpPacket(pp.rawValue, pp.portOffset);
+		return RtpChannelPrivate::fromProvider(d->c->read());
 	}
 	else
 		return RtpPacket();
@@ -867,12 +1251,92 @@ void RtpChannel::write(const RtpPacket &rtp)
 		}
 
 		PRtpPacket pp;
-		pp.rawValue = rtp.rawValue();
-		pp.portOffset = rtp.portOffset();
+		pp.rawValue = rtp.d->rawValue;
+		pp.portOffset = rtp.d->portOffset;
+		pp.owner = rtp.d->owner;
 		d->c->write(pp);
 	}
 }
 
+QList<RtpPacket> RtpChannel::readAll()
+{
+	return read(-1);
+}
+
+QList<RtpPacket> RtpChannel::read(int max)
+{
+	QList<RtpPacket> out;
+	if(d->c && max != 0)
+	{
+		QList<PRtpPacket> pps = d->c->readBatch(max);
+		out.reserve(pps.count());
+		foreach(const PRtpPacket &pp, pps)
+			out += RtpChannelPrivate::fromProvider(pp);
+	}
+	return out;
+}
+
+void RtpChannel::write(const QList<RtpPacket> &rtps)
+{
+	if(d->c)
+	{
+		if(!d->enabled)
+		{
+			d->enabled = true;
+			d->c->setEnabled(true);
+		}
+
+		QList<PRtpPacket> pps;
+		pps.reserve(rtps.count());
+		foreach(const RtpPacket &rtp, rtps)
+		{
+			PRtpPacket pp;
+			pp.rawValue = rtp.d->rawValue;
+			pp.portOffset = rtp.d->portOffset;
+			pp.owner = rtp.d->owner;
+			pps += pp;
+		}
+		d->c->writeBatch(pps);
+	}
+}
+
+void RtpChannel::setPacketSink(RtpPacketSink *sink)
+{
+	d->setSink(sink);
+}
+
+void RtpChannel::setQueueSize(int packets)
+{
+	d->queueSize = packets;
+	if(d->c)
+		d->c->setQueueSize(packets);
+}
+
+int RtpChannel::queueSize() const
+{
+	if(d->c)
+		return d->c->queueSize();
+	else if(d->queueSize != -1)
+		return qBound(1, d->queueSize, PRTP_QUEUE_LIMIT);
+	else
+		return PRTP_QUEUE_DEFAULT;
+}
+
+void RtpChannel::setHighWatermark(int packets)
+{
+	d->highWatermark = packets;
+	if(d->c)
+		d->c->setHighWatermark(packets);
+}
+
+int RtpChannel::droppedPackets() const
+{
+	if(d->c)
+		return d->c->packetsDropped();
+	else
+		return 0;
+}
+
 void RtpChannel::connectNotify(const char *signal)
 {
 	int oldtotal = d->readyReadListeners;
@@ -896,7 +1360,7 @@ void RtpChannel::disconnectNotify(const char *signal)
 		--d->readyReadListeners;
 
 	int total = d->readyReadListeners;
-	if(d->c && oldtotal > 0 && total == 0)
+	if(d->c && oldtotal > 0 && total == 0 && !d->sink && d->directWriters == 0)
 	{
 		d->enabled = false;
 		d->c->setEnabled(false);
@@ -1390,6 +1854,1022 @@ RtpChannel *RtpSession::videoRtpChannel()
 	return &d->videoRtpChannel;
 }
 
+//----------------------------------------------------------------------------
+// RtpLoopback
+//----------------------------------------------------------------------------
+// shortest time a reordered packet waits for one to follow it, in ms
+#define LOOPBACK_HOLD_MIN 20
+
+class RtpLoopback::Private : public RtpPacketSink
+{
+public:
+	class Delayed
+	{
+	public:
+		int due; // ms, relative to clock
+		RtpPacket packet;
+	};
+
+	class Thread : public QThread
+	{
+	public:
+		Private *d;
+
+		Thread(Private *_d) :
+			d(_d)
+		{
+		}
+
+	protected:
+		virtual void run()
+		{
+			d->run();
+		}
+	};
+
+	QPointer<RtpChannel> from, to;
+	RtpChannelPrivate *target; // for use from other threads
+
+	// everything below is protected by m
+	QMutex m;
+	QWaitCondition cond;
+	int delay, lossRate, reorderRate;
+	quint32 seed;
+	RtpPacket held; // waiting to swap places with the next packet
+	int held_due; // when held goes out anyway, if nothing follows it
+	QList<Delayed> pending;
+	QTime clock;
+	bool quit;
+	int forwarded, lost, reordered;
+
+	Thread *thread;
+
+	Private() :
+		target(0),
+		delay(0),
+		lossRate(0),
+		reorderRate(0),
+		seed(1),
+		held_due(0),
+		quit(false),
+		forwarded(0),
+		lost(0),
+		reordered(0),
+		thread(0)
+	{
+		clock.start();
+	}
+
+	// returns 0-99.  plain lcg, so runs are repeatable for a given seed
+	int roll()
+	{
+		seed = seed * 1103515245 + 12345;
+		return (int)((seed >> 16) % 100);
+	}
+
+	// note: this is executed from a media thread of the source channel
+	virtual void packetReady(const RtpPacket &packet)
+	{
+		QList<RtpPacket> out;
+
+		m.lock();
+		if(lossRate > 0 && roll() < lossRate)
+		{
+			++lost;
+			m.unlock();
+			return;
+		}
+
+		if(!held.isNull())
+		{
+			out += packet;
+			out += held;
+			held = RtpPacket();
+		}
+		else if(reorderRate > 0 && roll() < reorderRate)
+		{
+			++reordered;
+			held = packet;
+			held_due = clock.elapsed() + qMax(delay, LOOPBACK_HOLD_MIN);
+			cond.wakeOne();
+		}
+		else
+			out += packet;
+
+		forwarded += out.count();
+
+		// anything delayed must go through the thread, even if the
+		//   delay has since been set to 0, to keep the order
+		if(delay > 0 || !pending.isEmpty())
+		{
+			int due = clock.elapsed() + delay;
+			foreach(const RtpPacket &p, out)
+			{
+				Delayed d;
+				d.due = due;
+				d.packet = p;
+				pending += d;
+			}
+			if(!out.isEmpty())
+				cond.wakeOne();
+			out.clear();
+		}
+		m.unlock();
+
+		foreach(const RtpPacket &p, out)
+			target->directWrite(p);
+	}
+
+	void run()
+	{
+		m.lock();
+		while(!quit)
+		{
+			int now = clock.elapsed();
+
+			// the stream went quiet with a packet held back, so it
+			//   goes out on its own, after anything queued before it
+			if(!held.isNull() && now >= held_due)
+			{
+				Delayed d;
+				d.due = now;
+				d.packet = held;
+				pending += d;
+				held = RtpPacket();
+			}
+
+			int wait = -1;
+			if(!pending.isEmpty())
+				wait = qMax(pending.first().due - now, 0);
+			if(!held.isNull())
+				wait = (wait == -1) ? held_due - now : qMin(wait, held_due - now);
+
+			if(wait == -1)
+			{
+				cond.wait(&m);
+				continue;
+			}
+
+			if(wait > 0)
+			{
+				cond.wait(&m, wait);
+				continue;
+			}
+
+			RtpPacket p = pending.takeFirst().packet;
+			m.unlock();
+			target->directWrite(p);
+			m.lock();
+		}
+		m.unlock();
+	}
+};
+
+RtpLoopback::RtpLoopback(RtpChannel *from, RtpChannel *to, QObject *parent) :
+	QObject(parent)
+{
+	d = new Private;
+	d->from = from;
+	d->to = to;
+	d->target = to->d;
+
+	d->thread = new Private::Thread(d);
+	d->thread->start();
+
+	to->d->addDirectWriter();
+	from->setPacketSink(d);
+}
+
+RtpLoopback::~RtpLoopback()
+{
+	// waits for any delivery in progress, after which nothing new
+	//   can be queued
+	if(d->from)
+		d->from->setPacketSink(0);
+
+	d->m.lock();
+	d->quit = true;
+	d->cond.wakeOne();
+	d->m.unlock();
+	d->thread->wait();
+	delete d->thread;
+
+	if(d->to)
+		d->to->d->removeDirectWriter();
+
+	delete d;
+}
+
+void RtpLoopback::setDelay(int ms)
+{
+	QMutexLocker locker(&d->m);
+	d->delay = qMax(ms, 0);
+}
+
+void RtpLoopback::setLossRate(int percent)
+{
+	QMutexLocker locker(&d->m);
+	d->lossRate = qBound(0, percent, 100);
+}
+
+void RtpLoopback::setReorderRate(int percent)
+{
+	QMutexLocker locker(&d->m);
+	d->reorderRate = qBound(0, percent, 100);
+}
+
+void RtpLoopback::setSeed(uint seed)
+{
+	QMutexLocker locker(&d->m);
+	d->seed = seed;
+}
+
+int RtpLoopback::packetsForwarded() const
+{
+	QMutexLocker locker(&d->m);
+	return d->forwarded;
+}
+
+int RtpLoopback::packetsLost() const
+{
+	QMutexLocker locker(&d->m);
+	return d->lost;
+}
+
+int RtpLoopback::packetsReordered() const
+{
+	QMutexLocker locker(&d->m);
+	return d->reordered;
+}
+
+//----------------------------------------------------------------------------
+// RtpTransport
+//----------------------------------------------------------------------------
+#define TRANSPORT_BATCH     32   // datagrams per syscall
+#define TRANSPORT_BUFSIZE   2048 // largest datagram we receive
+#define TRANSPORT_OUT_MAX   256  // packets waiting to be sent
+
+#ifdef RTPTRANSPORT_GSO
+# define TRANSPORT_GSO_MAX  64   // segments per send, kernel limit
+#endif
+
+class RtpTransport::Private : public QObject, public RtpPacketSink
+{
+	Q_OBJECT
+
+public:
+	class Thread : public QThread
+	{
+	public:
+		Private *d;
+
+		Thread(Private *_d) :
+			d(_d)
+		{
+		}
+
+	protected:
+		virtual void run()
+		{
+#ifdef Q_OS_UNIX
+			d->run();
+#else
+			exec();
+
+			// the sockets belong to this thread
+			d->closeSockets();
+#endif
+		}
+	};
+
+	QPointer<RtpChannel> channel;
+	RtpChannelPrivate *target; // for use from other threads
+	Thread *thread;
+
+#ifdef Q_OS_UNIX
+	int family;
+	int sock[2];
+	int wakefd[2];
+
+	// only touched by the thread
+	char *recvbuf;
+	bool gso;
+
+	// everything below is protected by m
+	QMutex m;
+	QList<RtpPacket> out;
+	bool wake_pending;
+	bool quit;
+	QHostAddress remote_addr; // as given, converted once bound
+	int remote_port;
+	bool have_remote;
+	struct sockaddr_storage remote[2];
+	socklen_t remote_len;
+#else
+	QUdpSocket *sock[2];
+
+	// everything below is protected by m
+	QMutex m;
+	QList<RtpPacket> out;
+	bool wake_pending;
+	bool have_remote;
+	QHostAddress remote_addr;
+	int remote_port;
+#endif
+	int received, sent, dropped;
+
+	Private() :
+		target(0),
+		thread(0),
+#ifdef Q_OS_UNIX
+		family(AF_INET),
+		recvbuf(0),
+		gso(true),
+		wake_pending(false),
+		quit(false),
+		remote_port(0),
+		have_remote(false),
+		remote_len(0),
+#else
+		wake_pending(false),
+		have_remote(false),
+		remote_port(0),
+#endif
+		received(0),
+		sent(0),
+		dropped(0)
+	{
+#ifdef Q_OS_UNIX
+		sock[0] = -1;
+		sock[1] = -1;
+		wakefd[0] = -1;
+		wakefd[1] = -1;
+#else
+		sock[0] = 0;
+		sock[1] = 0;
+#endif
+	}
+
+	~Private()
+	{
+		stop();
+	}
+
+#ifdef Q_OS_UNIX
+	static bool toSockAddr(const QHostAddress &addr, int port, int family, struct sockaddr_storage *ss, socklen_t *len)
+	{
+		memset(ss, 0, sizeof(struct sockaddr_storage));
+
+		if(family == AF_INET6)
+		{
+			struct sockaddr_in6 *sa = (struct sockaddr_in6 *)ss;
+			sa->sin6_family = AF_INET6;
+			sa->sin6_port = htons(port);
+			if(addr.protocol() == QAbstractSocket::IPv6Protocol)
+			{
+				Q_IPV6ADDR a = addr.toIPv6Address();
+				memcpy(&sa->sin6_addr, &a, 16);
+			}
+			else
+			{
+				// v4-mapped
+				quint32 a = addr.toIPv4Address();
+				sa->sin6_addr.s6_addr[10] = 0xff;
+				sa->sin6_addr.s6_addr[11] = 0xff;
+				sa->sin6_addr.s6_addr[12] = (a >> 24) & 0xff;
+				sa->sin6_addr.s6_addr[13] = (a >> 16) & 0xff;
+				sa->sin6_addr.s6_addr[14] = (a >> 8) & 0xff;
+				sa->sin6_addr.s6_addr[15] = a & 0xff;
+			}
+			*len = sizeof(struct sockaddr_in6);
+		}
+		else
+		{
+			if(addr.protocol() == QAbstractSocket::IPv6Protocol)
+				return false;
+
+			struct sockaddr_in *sa = (struct sockaddr_in *)ss;
+			sa->sin_family = AF_INET;
+			sa->sin_port = htons(port);
+			sa->sin_addr.s_addr = htonl(addr.toIPv4Address());
+			*len = sizeof(struct sockaddr_in);
+		}
+
+		return true;
+	}
+
+	static void setNonBlocking(int fd)
+	{
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	}
+
+	bool bind(const QHostAddress &addr, int basePort)
+	{
+		family = (addr.protocol() == QAbstractSocket::IPv6Protocol) ? AF_INET6 : AF_INET;
+
+		for(int n = 0; n < 2; ++n)
+		{
+			struct sockaddr_storage ss;
+			socklen_t len;
+			toSockAddr(addr, basePort > 0 ? basePort + n : 0, family, &ss, &len);
+
+			sock[n] = socket(family, SOCK_DGRAM, 0);
+			if(sock[n] == -1)
+				return false;
+
+			// a bit of room for bursts, while the thread is busy
+			int bufsize = 256 * 1024;
+			setsockopt(sock[n], SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+			setsockopt(sock[n], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+
+			if(::bind(sock[n], (struct sockaddr *)&ss, len) != 0)
+				return false;
+		}
+
+		if(pipe(wakefd) != 0)
+		{
+			wakefd[0] = -1;
+			wakefd[1] = -1;
+			return false;
+		}
+		setNonBlocking(wakefd[0]);
+		setNonBlocking(wakefd[1]);
+
+		// a remote set before now was converted for the wrong family
+		m.lock();
+		updateRemote();
+		m.unlock();
+
+		recvbuf = (char *)malloc(TRANSPORT_BATCH * TRANSPORT_BUFSIZE);
+
+		thread = new Thread(this);
+		thread->start();
+		return true;
+	}
+
+	void stop()
+	{
+		if(thread)
+		{
+			m.lock();
+			quit = true;
+			m.unlock();
+			wake();
+
+			thread->wait();
+			delete thread;
+			thread = 0;
+		}
+
+		for(int n = 0; n < 2; ++n)
+		{
+			if(sock[n] != -1)
+			{
+				close(sock[n]);
+				sock[n] = -1;
+			}
+			if(wakefd[n] != -1)
+			{
+				close(wakefd[n]);
+				wakefd[n] = -1;
+			}
+		}
+
+		free(recvbuf);
+		recvbuf = 0;
+	}
+
+	void setRemote(const QHostAddress &addr, int basePort)
+	{
+		QMutexLocker locker(&m);
+		remote_addr = addr;
+		remote_port = basePort;
+		updateRemote();
+	}
+
+	// call with m held.  the address can only be converted once we know
+	//   the family of the sockets, i.e. once bound
+	void updateRemote()
+	{
+		have_remote = (sock[0] != -1 && !remote_addr.isNull() &&
+			toSockAddr(remote_addr, remote_port, family, &remote[0], &remote_len) &&
+			toSockAddr(remote_addr, remote_port + 1, family, &remote[1], &remote_len));
+	}
+
+	void wake()
+	{
+		char c = 0;
+		if(write(wakefd[1], &c, 1) < 0)
+		{
+			// pipe is full, so a wakeup is already pending
+		}
+	}
+
+	// note: this is executed from a media thread of the channel
+	virtual void packetReady(const RtpPacket &packet)
+	{
+		bool needWake = false;
+
+		m.lock();
+		if(out.count() >= TRANSPORT_OUT_MAX || !have_remote)
+			++dropped;
+		else
+		{
+			out += packet;
+			if(!wake_pending)
+			{
+				wake_pending = true;
+				needWake = true;
+			}
+		}
+		m.unlock();
+
+		// one wakeup per batch, however many packets pile up meanwhile
+		if(needWake)
+			wake();
+	}
+
+	void run()
+	{
+		struct pollfd pfd[3];
+		pfd[0].fd = sock[0];
+		pfd[1].fd = sock[1];
+		pfd[2].fd = wakefd[0];
+
+		while(true)
+		{
+			for(int n = 0; n < 3; ++n)
+			{
+				pfd[n].events = POLLIN;
+				pfd[n].revents = 0;
+			}
+
+			if(poll(pfd, 3, -1) < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				break;
+			}
+
+			if(pfd[2].revents & POLLIN)
+			{
+				char buf[64];
+				while(read(wakefd[0], buf, sizeof(buf)) > 0)
+				{
+				}
+
+				m.lock();
+				if(quit)
+				{
+					m.unlock();
+					break;
+				}
+
+				QList<RtpPacket> packets = out;
+				out.clear();
+				wake_pending = false;
+				struct sockaddr_storage dest[2];
+				memcpy(dest, remote, sizeof(dest));
+				socklen_t dest_len = remote_len;
+				m.unlock();
+
+				if(!packets.isEmpty())
+					send(packets, dest, dest_len);
+			}
+
+			for(int n = 0; n < 2; ++n)
+			{
+				if(pfd[n].revents & POLLIN)
+					receive(n);
+			}
+		}
+	}
+
+	void receive(int offset)
+	{
+		int got;
+		do
+		{
+			QList<RtpPacket> packets;
+
+#ifdef RTPTRANSPORT_MMSG
+			struct mmsghdr msgs[TRANSPORT_BATCH];
+			struct iovec iovs[TRANSPORT_BATCH];
+			memset(msgs, 0, sizeof(msgs));
+			for(int n = 0; n < TRANSPORT_BATCH; ++n)
+			{
+				iovs[n].iov_base = recvbuf + n * TRANSPORT_BUFSIZE;
+				iovs[n].iov_len = TRANSPORT_BUFSIZE;
+				msgs[n].msg_hdr.msg_iov = &iovs[n];
+				msgs[n].msg_hdr.msg_iovlen = 1;
+			}
+
+			got = recvmmsg(sock[offset], msgs, TRANSPORT_BATCH, MSG_DONTWAIT, 0);
+			if(got <= 0)
+				return;
+
+			packets.reserve(got);
+			for(int n = 0; n < got; ++n)
+			{
+				if(msgs[n].msg_hdr.msg_flags & MSG_TRUNC)
+					continue;
+
+				packets += RtpPacket(recvbuf + n * TRANSPORT_BUFSIZE, msgs[n].msg_len, offset);
+			}
+#else
+			for(got = 0; got < TRANSPORT_BATCH; ++got)
+			{
+				ssize_t size = recv(sock[offset], recvbuf, TRANSPORT_BUFSIZE, MSG_DONTWAIT);
+				if(size < 0)
+					break;
+
+				packets += RtpPacket(recvbuf, (int)size, offset);
+			}
+#endif
+
+			if(!packets.isEmpty())
+			{
+				m.lock();
+				received += packets.count();
+				m.unlock();
+
+				target->directWrite(packets);
+			}
+
+			// a full batch means there may be more waiting
+		} while(got == TRANSPORT_BATCH);
+	}
+
+	void send(const QList<RtpPacket> &packets, const struct sockaddr_storage *dest, socklen_t dest_len)
+	{
+		// the two sockets are sent separately.  order only matters
+		//   within each
+		QList<RtpPacket> byOffset[2];
+		foreach(const RtpPacket &p, packets)
+		{
+			int offset = p.portOffset();
+			if(offset == 0 || offset == 1)
+				byOffset[offset] += p;
+		}
+
+		int ok = 0;
+		for(int n = 0; n < 2; ++n)
+		{
+			if(!byOffset[n].isEmpty())
+				ok += send(sock[n], byOffset[n], &dest[n], dest_len);
+		}
+
+		m.lock();
+		sent += ok;
+		dropped += packets.count() - ok;
+		m.unlock();
+	}
+
+#ifdef RTPTRANSPORT_MMSG
+	// returns the number of packets sent
+	int send(int fd, const QList<RtpPacket> &packets, const struct sockaddr_storage *dest, socklen_t dest_len)
+	{
+		struct mmsghdr msgs[TRANSPORT_BATCH];
+		int counts[TRANSPORT_BATCH];
+#ifdef RTPTRANSPORT_GSO
+		struct iovec iovs[TRANSPORT_BATCH * TRANSPORT_GSO_MAX];
+		union
+		{
+			char buf[CMSG_SPACE(sizeof(quint16))];
+			struct cmsghdr align;
+		} ctrl[TRANSPORT_BATCH];
+#else
+		struct iovec iovs[TRANSPORT_BATCH];
+#endif
+
+		int total = 0;
+		int at = 0;
+		while(at < packets.count())
+		{
+#ifdef RTPTRANSPORT_GSO
+			bool useGso = gso;
+#endif
+			int start = at;
+			int nmsgs = 0;
+			int niovs = 0;
+			memset(msgs, 0, sizeof(msgs));
+
+			while(at < packets.count() && nmsgs < TRANSPORT_BATCH)
+			{
+				struct msghdr *hdr = &msgs[nmsgs].msg_hdr;
+				hdr->msg_name = (void *)dest;
+				hdr->msg_namelen = dest_len;
+				hdr->msg_iov = &iovs[niovs];
+
+				int first = at;
+				int segsize = packets[at].size();
+				iovs[niovs].iov_base = (void *)packets[at].constData();
+				iovs[niovs].iov_len = segsize;
+				++niovs;
+				++at;
+
+#ifdef RTPTRANSPORT_GSO
+				// gso splits one large send into segments of the
+				//   first packet's size, where only the last may be
+				//   shorter.  so pack packets for as long as that
+				//   holds
+				if(useGso)
+				{
+					int bytes = segsize;
+					while(at < packets.count() && at - first < TRANSPORT_GSO_MAX)
+					{
+						int size = packets[at].size();
+						if(size > segsize || bytes + size > 65000)
+							break;
+
+						iovs[niovs].iov_base = (void *)packets[at].constData();
+						iovs[niovs].iov_len = size;
+						++niovs;
+						++at;
+						bytes += size;
+
+						if(size < segsize)
+							break;
+					}
+
+					if(at - first > 1)
+					{
+						hdr->msg_control = ctrl[nmsgs].buf;
+						hdr->msg_controllen = sizeof(ctrl[nmsgs].buf);
+						struct cmsghdr *cm = CMSG_FIRSTHDR(hdr);
+						cm->cmsg_level = SOL_UDP;
+						cm->cmsg_type = UDP_SEGMENT;
+						cm->cmsg_len = CMSG_LEN(sizeof(quint16));
+						quint16 gsosize = segsize;
+						memcpy(CMSG_DATA(cm), &gsosize, sizeof(gsosize));
+					}
+				}
+#endif
+
+				hdr->msg_iovlen = at - first;
+				counts[nmsgs] = at - first;
+				++nmsgs;
+			}
+
+			int done = 0;
+			while(done < nmsgs)
+			{
+				int ret = sendmmsg(fd, msgs + done, nmsgs - done, 0);
+				if(ret < 0)
+				{
+					if(errno == EINTR)
+						continue;
+
+#ifdef RTPTRANSPORT_GSO
+					// kernel or device can't do gso.  turn it off
+					//   and redo the rest of the batch without it
+					if(useGso && (errno == EINVAL || errno == EIO || errno == ENOPROTOOPT))
+					{
+						gso = false;
+						break;
+					}
+#endif
+
+					// skip the message that failed
+					++done;
+					continue;
+				}
+
+				for(int n = done; n < done + ret; ++n)
+					total += counts[n];
+				done += ret;
+			}
+
+			if(done < nmsgs)
+			{
+				at = start;
+				for(int n = 0; n < done; ++n)
+					at += counts[n];
+			}
+		}
+
+		return total;
+	}
+#else
+	int send(int fd, const QList<RtpPacket> &packets, const struct sockaddr_storage *dest, socklen_t dest_len)
+	{
+		int total = 0;
+		foreach(const RtpPacket &p, packets)
+		{
+			if(sendto(fd, p.constData(), p.size(), 0, (const struct sockaddr *)dest, dest_len) == p.size())
+				++total;
+		}
+		return total;
+	}
+#endif
+#else
+	bool bind(const QHostAddress &addr, int basePort)
+	{
+		for(int n = 0; n < 2; ++n)
+		{
+			sock[n] = new QUdpSocket;
+			if(!sock[n]->bind(addr, basePort > 0 ? basePort + n : 0))
+				return false;
+
+			// a bit of room for bursts, while the thread is busy
+#if QT_VERSION >= 0x050300
+			sock[n]->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, 256 * 1024);
+			sock[n]->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, 256 * 1024);
+#endif
+			connect(sock[n], SIGNAL(readyRead()), SLOT(sock_readyRead()));
+		}
+
+		// the sockets are serviced from the eventloop of the thread
+		thread = new Thread(this);
+		moveToThread(thread);
+		sock[0]->moveToThread(thread);
+		sock[1]->moveToThread(thread);
+		thread->start();
+		return true;
+	}
+
+	void stop()
+	{
+		if(thread)
+		{
+			thread->quit();
+			thread->wait();
+			delete thread;
+			thread = 0;
+		}
+
+		// in case the thread never started
+		closeSockets();
+	}
+
+	void closeSockets()
+	{
+		for(int n = 0; n < 2; ++n)
+		{
+			delete sock[n];
+			sock[n] = 0;
+		}
+	}
+
+	void setRemote(const QHostAddress &addr, int basePort)
+	{
+		QMutexLocker locker(&m);
+		remote_addr = addr;
+		remote_port = basePort;
+		have_remote = !addr.isNull();
+	}
+
+	// note: this is executed from a media thread of the channel
+	virtual void packetReady(const RtpPacket &packet)
+	{
+		bool needWake = false;
+
+		m.lock();
+		if(out.count() >= TRANSPORT_OUT_MAX || !have_remote)
+			++dropped;
+		else
+		{
+			out += packet;
+			if(!wake_pending)
+			{
+				wake_pending = true;
+				needWake = true;
+			}
+		}
+		m.unlock();
+
+		// one wakeup per batch, however many packets pile up meanwhile
+		if(needWake)
+			QMetaObject::invokeMethod(this, "doSend", Qt::QueuedConnection);
+	}
+#endif // Q_OS_UNIX
+
+	// the slots are only connected without Q_OS_UNIX, where the sockets
+	//   are QUdpSockets
+private slots:
+	void sock_readyRead()
+	{
+#ifndef Q_OS_UNIX
+		QUdpSocket *s = (QUdpSocket *)sender();
+		int offset = (s == sock[0]) ? 0 : 1;
+
+		char buf[TRANSPORT_BUFSIZE];
+		while(s->hasPendingDatagrams())
+		{
+			QList<RtpPacket> packets;
+			while(packets.count() < TRANSPORT_BATCH && s->hasPendingDatagrams())
+			{
+				qint64 size = s->readDatagram(buf, sizeof(buf));
+				if(size < 0)
+					break;
+
+				packets += RtpPacket(buf, (int)size, offset);
+			}
+
+			if(packets.isEmpty())
+				break;
+
+			m.lock();
+			received += packets.count();
+			m.unlock();
+
+			target->directWrite(packets);
+		}
+#endif
+	}
+
+	void doSend()
+	{
+#ifndef Q_OS_UNIX
+		m.lock();
+		QList<RtpPacket> packets = out;
+		out.clear();
+		wake_pending = false;
+		QHostAddress addr = remote_addr;
+		int port = remote_port;
+		m.unlock();
+
+		int ok = 0;
+		foreach(const RtpPacket &p, packets)
+		{
+			int offset = p.portOffset();
+			if(offset != 0 && offset != 1)
+				continue;
+
+			if(sock[offset]->writeDatagram(p.constData(), p.size(), addr, port + offset) == p.size())
+				++ok;
+		}
+
+		m.lock();
+		sent += ok;
+		dropped += packets.count() - ok;
+		m.unlock();
+#endif
+	}
+};
+
+RtpTransport::RtpTransport(RtpChannel *channel, QObject *parent) :
+	QObject(parent)
+{
+	d = new Private;
+	d->channel = channel;
+	d->target = channel->d;
+
+	channel->d->addDirectWriter();
+}
+
+RtpTransport::~RtpTransport()
+{
+	// waits for any delivery in progress
+	if(d->channel)
+		d->channel->setPacketSink(0);
+
+	d->stop();
+
+	if(d->channel)
+		d->channel->d->removeDirectWriter();
+
+	delete d;
+}
+
+bool RtpTransport::bind(const QHostAddress &addr, int basePort)
+{
+	if(d->thread)
+		return false;
+
+	if(!d->bind(addr, basePort))
+	{
+		d->stop();
+		return false;
+	}
+
+	d->channel->setPacketSink(d);
+	return true;
+}
+
+void RtpTransport::setRemote(const QHostAddress &addr, int basePort)
+{
+	d->setRemote(addr, basePort);
+}
+
+int RtpTransport::packetsReceived() const
+{
+	QMutexLocker locker(&d->m);
+	return d->received;
+}
+
+int RtpTransport::packetsSent() const
+{
+	QMutexLocker locker(&d->m);
+	return d->sent;
+}
+
+int RtpTransport::packetsDropped() const
+{
+	QMutexLocker locker(&d->m);
+	return d->dropped;
+}
+
 }
 
 #include "psimedia.moc"
@@ -29,6 +29,8 @@
 #include <QWidget>
 #endif
 
+class QHostAddress;
+
 namespace PsiMedia {
 
 class RtpSession;
@@ -204,6 +206,11 @@ class RtpPacket
 public:
 	RtpPacket();
 	RtpPacket(const QByteArray &rawValue, int portOffset);
+
+	// copies the bytes into a recycled buffer, which avoids heap
+	//   allocation for anything up to a typical mtu
+	RtpPacket(const char *data, int size, int portOffset);
+
 	RtpPacket(const RtpPacket &other);
 	~RtpPacket();
 	RtpPacket & operator=(const RtpPacket &other);
@@ -213,12 +220,66 @@ public:
 	QByteArray rawValue() const;
 	int portOffset() const;
 
+	// direct access to the packet bytes.  unlike rawValue(), this never
+	//   copies, and the pointer is valid for as long as this packet (or
+	//   a copy of it) exists
+	const char *constData() const;
+	int size() const;
+
+	// rtp header fields, read straight out of the packet bytes without
+	//   copying.  only meaningful for rtp (not rtcp) packets.  if the
+	//   packet is too short to hold a header, these return 0/false
+	bool hasRtpHeader() const;
+	int payloadType() const;
+	bool marker() const;
+	quint16 sequence() const;
+	quint32 timestamp() const;
+	quint32 ssrc() const;
+
+	// the payload, after any csrcs and header extension, and not
+	//   counting padding.  points into the packet, like constData().
+	//   null/0 if there is none, or the header doesn't parse
+	const char *payloadData() const;
+	int payloadSize() const;
+
+	// for verifying that packets are being recycled: the number of
+	//   packet allocations that had to go to the heap, and the number
+	//   that were served from the pool instead.  this includes the list
+	//   nodes that QList<RtpPacket> makes, and the QByteArray header that
+	//   every packet built from raw bytes needs, which is never recycled
+	static int allocatedCount();
+	static int recycledCount();
+
+	// QList holds packets through a node allocated with these, which
+	//   are recycled like the packets themselves
+	static void *operator new(size_t size);
+	static void operator delete(void *p, size_t size);
+
 private:
 	class Private;
 	QSharedDataPointer<Private> d;
+
+	friend class RtpChannel;
+	friend class RtpChannelPrivate;
+	friend class RtpPacketPool;
 };
 
-// may drop packets if not read fast enough.
+// receives packets directly from the media thread, see
+//   RtpChannel::setPacketSink()
+class RtpPacketSink
+{
+public:
+	virtual ~RtpPacketSink();
+
+	// called from a media thread, not the thread of the RtpChannel.
+	//   must be thread-safe and should return quickly
+	virtual void packetReady(const RtpPacket &packet) = 0;
+};
+
+// may drop packets if not read fast enough.  at most queueSize() packets
+//   are held for reading, and beyond that the oldest are dropped.  drops
+//   are reported with packetsDropped, and highWatermark is a warning that
+//   the queue is getting close to full.
 // may queue no packets at all, if nobody is listening to readyRead.
 class RtpChannel : public QObject
 {
@@ -229,9 +290,42 @@ public:
 	RtpPacket read();
 	void write(const RtpPacket &rtp);
 
+	// same as calling read() or write() on each packet, but cheaper
+	//   for bursts
+	QList<RtpPacket> readAll();
+	QList<RtpPacket> read(int max);
+	void write(const QList<RtpPacket> &rtps);
+
+	// same as write() of a list, kept for existing callers
+	inline void writeBatch(const QList<RtpPacket> &rtps) { write(rtps); }
+
+	// deliver incoming packets straight to sink from the media thread,
+	//   rather than queuing them and emitting readyRead, so that a busy
+	//   eventloop doesn't hold them up.  the sink is not owned.  pass 0
+	//   to go back to readyRead.  this waits for any delivery in
+	//   progress, so the sink may be deleted once this returns, but it
+	//   must not be called from within the sink
+	void setPacketSink(RtpPacketSink *sink);
+
+	// default 32, maximum 1024
+	void setQueueSize(int packets);
+	int queueSize() const;
+
+	// highWatermark is emitted when this many packets are waiting to be
+	//   read.  default (-1) is 3/4 of the queue size.  0 turns it off
+	void setHighWatermark(int packets);
+
+	// total number of packets dropped so far
+	int droppedPackets() const;
+
 signals:
 	void readyRead();
 	void packetsWritten(int count);
+	void packetsDropped(int count);
+
+	// emitted once when the queue reaches the mark, and not again until
+	//   it has first gone back below it
+	void highWatermark(int queued);
 
 protected:
 	virtual void connectNotify(const char *signal);
@@ -245,6 +339,8 @@ private:
 	friend class RtpSession;
 	friend class RtpSessionPrivate;
 	friend class RtpChannelPrivate;
+	friend class RtpLoopback;
+	friend class RtpTransport;
 	RtpChannelPrivate *d;
 };
 
@@ -500,6 +596,86 @@ private:
 	RtpSessionPrivate *d;
 };
 
+// connects the output of one channel straight to the input of another,
+//   in-process, for testing and benchmarking without a network.  packets
+//   are handed over from the media thread (using the packet sink of the
+//   source channel, so that can't be used for anything else meanwhile),
+//   never passing through an eventloop.  for a full call, use one loopback
+//   per channel per direction.
+// network conditions can be simulated with a fixed delay, random loss and
+//   reordering.  randomness comes from a simple generator seeded with
+//   setSeed(), so a given seed always gives the same pattern.
+// the loopback must be deleted before either channel (i.e. session).
+class RtpLoopback : public QObject
+{
+	Q_OBJECT
+
+public:
+	RtpLoopback(RtpChannel *from, RtpChannel *to, QObject *parent = 0);
+	~RtpLoopback();
+
+	void setDelay(int ms); // default 0
+	void setLossRate(int percent); // 0-100, default 0
+
+	// a reordered packet swaps places with the one that follows it.  if
+	//   none follows within the delay (or 20ms, whichever is longer), it
+	//   goes out on its own
+	void setReorderRate(int percent); // 0-100, default 0
+
+	void setSeed(uint seed);
+
+	int packetsForwarded() const;
+	int packetsLost() const;
+	int packetsReordered() const;
+
+private:
+	Q_DISABLE_COPY(RtpLoopback);
+
+	class Private;
+	friend class Private;
+	Private *d;
+};
+
+// carries the packets of a channel over udp, on a pair of sockets: rtp on
+//   the base port and rtcp on the port above it.  all socket work happens
+//   on a dedicated thread, and packets are exchanged with the channel
+//   from there, without going through an eventloop.  like RtpLoopback,
+//   this takes over the packet sink of the channel.
+// on linux, datagrams are moved in batches with recvmmsg/sendmmsg, and
+//   runs of equally sized packets are sent with udp segmentation offload
+//   when the kernel supports it.  other unix systems fall back to one
+//   syscall per datagram.  elsewhere, a pair of QUdpSockets is serviced
+//   from the eventloop of the thread, one datagram at a time.
+// the transport must be deleted before the channel (i.e. session).
+class RtpTransport : public QObject
+{
+	Q_OBJECT
+
+public:
+	RtpTransport(RtpChannel *channel, QObject *parent = 0);
+	~RtpTransport();
+
+	// binds both ports and starts the transport thread.  with a base
+	//   port of 0, the system picks each port
+	bool bind(const QHostAddress &addr, int basePort);
+
+	// where outgoing packets go.  until this is set, they are dropped.
+	//   this may be called before or after bind().  binding to ipv6
+	//   allows an ipv4 remote, but not the other way around
+	void setRemote(const QHostAddress &addr, int basePort);
+
+	int packetsReceived() const;
+	int packetsSent() const;
+	int packetsDropped() const; // send failures and overflow
+
+private:
+	Q_DISABLE_COPY(RtpTransport);
+
+	class Private;
+	friend class Private;
+	Private *d;
+};
+
 }
 
 #endif
@@ -1,3 +1,5 @@
+QT += network
+
 HEADERS += \
 	$$PWD/psimedia.h \
 	$$PWD/psimediaprovider.h
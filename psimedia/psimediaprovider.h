@@ -24,6 +24,9 @@
 #include <QString>
 #include <QList>
 #include <QByteArray>
+#include <QSharedData>
+#include <QAtomicInt>
+#include <QAtomicPointer>
 #include <QSize>
 #include <QObject>
 
@@ -41,6 +44,10 @@ class QPainter;
 #define HINT_PUBLIC_SLOTS public
 #define HINT_METHOD(x)
 
+// queue size of RtpChannelContext, in packets
+#define PRTP_QUEUE_DEFAULT 32
+#define PRTP_QUEUE_LIMIT 1024 // must be a power of 2
+
 namespace PsiMedia {
 
 class Provider;
@@ -144,16 +151,199 @@ public:
 	}
 };
 
+// lock-free cache of equally sized memory blocks, for objects that are
+//   created and destroyed at packet rate.  such a class gives itself an
+//   operator new and delete that call alloc() and free().  a block may be
+//   freed from any thread, and objects bigger than the block size (e.g.
+//   subclasses) simply bypass the cache.  declare it as a static, so that
+//   it starts out zeroed.  the counters are for verifying that recycling
+//   actually happens.
+// there is one cache per object type, for the whole process, rather than
+//   one per channel: the objects travel between the threads of several
+//   channels and may outlive the channel that made them, and this way at
+//   most Slots blocks of each type are held however many channels exist.
+// the cached blocks sit in a Treiber stack of entries, and the entries
+//   not holding a block sit in another one, so both calls take a pop and a
+//   push.  a stack head packs its top entry (index + 1, 0 if empty) into
+//   the low 16 bits and a tag into the high 16 bits.  the tag changes on
+//   every update, so that a head which was popped and pushed back in the
+//   meantime doesn't compare equal (ABA).  Slots must be below 65535.
+template <int BlockSize, int Slots>
+class PBlockCache
+{
+public:
+	struct Entry
+	{
+		char *block;
+		QBasicAtomicInt next; // index + 1 of the entry below
+	};
+
+	Entry entries[Slots];
+	QBasicAtomicInt full; // entries holding a block
+	QBasicAtomicInt empty; // entries free to take one
+	QBasicAtomicInt fresh; // entries never used so far
+	QBasicAtomicInt allocated; // blocks that had to come from the heap
+	QBasicAtomicInt recycled; // allocations served from the cache
+
+	void *alloc(size_t size)
+	{
+		if(size > (size_t)BlockSize)
+			return ::operator new(size);
+
+		int n = pop(full);
+		if(n != -1)
+		{
+			char *p = entries[n].block;
+			push(empty, n);
+			recycled.ref();
+			return p;
+		}
+
+		allocated.ref();
+		return ::operator new(BlockSize);
+	}
+
+	void free(void *p, size_t size)
+	{
+		if(!p)
+			return;
+
+		if(size <= (size_t)BlockSize)
+		{
+			int n = pop(empty);
+			if(n == -1)
+				n = takeFresh();
+			if(n != -1)
+			{
+				entries[n].block = (char *)p;
+				push(full, n);
+				return;
+			}
+		}
+
+		::operator delete(p);
+	}
+
+	int allocatedCount()
+	{
+		return allocated.fetchAndAddRelaxed(0);
+	}
+
+	int recycledCount()
+	{
+		return recycled.fetchAndAddRelaxed(0);
+	}
+
+private:
+	static int nextHead(int head, int top)
+	{
+		return (int)(((uint)head & 0xffff0000u) + 0x10000u) | top;
+	}
+
+	// returns an entry index, or -1 if the stack is empty
+	int pop(QBasicAtomicInt &head)
+	{
+		while(true)
+		{
+			int h = head.fetchAndAddAcquire(0);
+			int top = h & 0xffff;
+			if(top == 0)
+				return -1;
+
+			// if the entry was taken meanwhile, this is stale, but
+			//   then the tag has moved on and the swap fails
+			int next = entries[top - 1].next.fetchAndAddRelaxed(0);
+			if(head.testAndSetAcquire(h, nextHead(h, next)))
+				return top - 1;
+		}
+	}
+
+	// release, so that the block of the entry is seen by whoever pops it
+	void push(QBasicAtomicInt &head, int n)
+	{
+		while(true)
+		{
+			int h = head.fetchAndAddRelaxed(0);
+			entries[n].next.fetchAndStoreRelaxed(h & 0xffff);
+			if(head.testAndSetRelease(h, nextHead(h, n + 1)))
+				return;
+		}
+	}
+
+	// an entry that was never used yet.  these run out once the cache
+	//   has been full
+	int takeFresh()
+	{
+		if(fresh.fetchAndAddRelaxed(0) >= Slots)
+			return -1;
+
+		int n = fresh.fetchAndAddRelaxed(1);
+		return (n < Slots) ? n : -1;
+	}
+};
+
+// a provider may hand out packets whose rawValue refers to memory it owns
+//   (see QByteArray::fromRawData), rather than copying.  in that case it
+//   sets owner to an object that keeps the memory alive and releases it
+//   when destroyed, and rawValue must not be used beyond owner's lifetime.
+class PRtpPacketData : public QSharedData
+{
+public:
+	virtual ~PRtpPacketData()
+	{
+	}
+};
+
 class PRtpPacket
 {
 public:
 	QByteArray rawValue;
 	int portOffset;
+	QExplicitlySharedDataPointer<PRtpPacketData> owner; // read-only, never detached
 
 	inline PRtpPacket() :
 		portOffset(0)
 	{
 	}
+
+	// QList holds packets through a node allocated with these, which
+	//   are recycled
+	static void *operator new(size_t size);
+	static void operator delete(void *p, size_t size);
+};
+
+// maximum number of recycled list nodes held in reserve
+#define PRTP_PACKET_POOL_SIZE 256
+
+typedef PBlockCache<sizeof(PRtpPacket), PRTP_PACKET_POOL_SIZE> PRtpPacketCache;
+
+// each module using this header gets its own cache, which is fine since
+//   a node may be freed to any of them
+inline PRtpPacketCache &prtppacket_cache()
+{
+	static PRtpPacketCache cache;
+	return cache;
+}
+
+inline void *PRtpPacket::operator new(size_t size)
+{
+	return prtppacket_cache().alloc(size);
+}
+
+inline void PRtpPacket::operator delete(void *p, size_t size)
+{
+	prtppacket_cache().free(p, size);
+}
+
+// called from whatever thread produced the packet
+class PRtpPacketSink
+{
+public:
+	virtual ~PRtpPacketSink()
+	{
+	}
+
+	virtual void packetReady(const PRtpPacket &packet) = 0;
 };
 
 class Provider : public QObjectInterface
@@ -194,11 +384,27 @@ public:
 
 	virtual int packetsAvailable() const = 0;
 	virtual PRtpPacket read() = 0;
+	virtual QList<PRtpPacket> readBatch(int max) = 0; // max -1 = all
 	virtual void write(const PRtpPacket &rtp) = 0;
+	virtual void writeBatch(const QList<PRtpPacket> &rtps) = 0;
+
+	// while a sink is set, incoming packets go to it directly instead
+	//   of being queued for read().  setting the sink (or clearing it
+	//   with 0) waits for any delivery in progress to complete
+	virtual void setPacketSink(PRtpPacketSink *sink) = 0;
+
+	// packets beyond the queue size are dropped, oldest first.  the size
+	//   is PRTP_QUEUE_DEFAULT until set, and at most PRTP_QUEUE_LIMIT
+	virtual void setQueueSize(int packets) = 0;
+	virtual int queueSize() = 0;
+	virtual void setHighWatermark(int packets) = 0; // -1 = default
+	virtual int packetsDropped() = 0; // total so far
 
 HINT_SIGNALS:
 	HINT_METHOD(readyRead())
 	HINT_METHOD(packetsWritten(int count))
+	HINT_METHOD(packetsDropped(int count))
+	HINT_METHOD(highWatermark(int queued))
 };
 
 #ifdef QT_GUI_LIB
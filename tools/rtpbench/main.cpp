@@ -0,0 +1,645 @@
+/*
+ * Copyright (C) 2008  Barracuda Networks, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ *
+ */
+
+// rtpbench: runs a number of concurrent sessions in one process, with
+//   no network, and prints packet rates, cpu use and arrival jitter.
+//
+// each session sends a looped file (or a live audio device).  with
+//   --loopback, the packets are fed through RtpLoopback into a second
+//   session per call, so that they take the receive path (apprtpsrc
+//   ingress, rtp session, depay and decode).  otherwise they are timed
+//   as they come out of the sender, which is what shows scheduling
+//   trouble in the capture and encode threads.
+//
+// examples:
+//   compare cpu per session as calls are added:
+//     rtpbench --file=call.ogg --loopback --sessions=1,2,4,8,16
+//   jitter of a live microphone under load, with and without
+//     PSI_AUDIO_RT=fifo and PSI_CPU_AUDIO=2 in the environment:
+//     rtpbench --audio-in=<id> --load=4 --seconds=30
+//
+// cpu time is for the whole process, so it includes the --load
+//   threads.  set RTPWORKER_DEBUG to also get the apprtpsrc buffer
+//   counters printed as each session is torn down.  on a host without a
+//   display, use QT_QPA_PLATFORM=offscreen (qt5).
+
+#include <QApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QLibrary>
+#include <QMutex>
+#include <QStringList>
+#include <QThread>
+#include <QTimer>
+#include <stdio.h>
+#include "psimedia.h"
+
+#ifdef Q_OS_UNIX
+# include <sys/time.h>
+# include <sys/resource.h>
+#endif
+
+// user+system time of the process, in microseconds, or -1
+static qint64 process_cpu_time()
+{
+#ifdef Q_OS_UNIX
+	struct rusage ru;
+	if(getrusage(RUSAGE_SELF, &ru) != 0)
+		return -1;
+	return ((qint64)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#else
+	return -1;
+#endif
+}
+
+// burns a core, to see how the media threads hold up under load
+class LoadThread : public QThread
+{
+public:
+	volatile bool quit;
+
+	LoadThread() :
+		quit(false)
+	{
+	}
+
+protected:
+	virtual void run()
+	{
+		volatile quint32 x = 1;
+		while(!quit)
+			x = x * 1103515245 + 12345;
+	}
+};
+
+// counts the packets coming out of a channel, and keeps the rfc 3550
+//   interarrival jitter of the rtp ones
+class PacketProbe : public PsiMedia::RtpPacketSink
+{
+public:
+	QMutex m;
+	QElapsedTimer timer;
+	int clockrate;
+	int packets;
+	qint64 bytes;
+	double jitter; // usecs
+	double max_jitter;
+	int late; // gap of more than twice the media time between packets
+
+	bool have_last;
+	qint64 last_arrival; // usecs
+	quint32 last_ts;
+
+	PacketProbe() :
+		clockrate(0),
+		have_last(false),
+		last_arrival(0),
+		last_ts(0)
+	{
+		timer.start();
+		reset();
+	}
+
+	// starts a new measurement window
+	void reset()
+	{
+		QMutexLocker locker(&m);
+		packets = 0;
+		bytes = 0;
+		jitter = 0;
+		max_jitter = 0;
+		late = 0;
+	}
+
+	// note: this is executed from a media thread
+	virtual void packetReady(const PsiMedia::RtpPacket &packet)
+	{
+		qint64 now = timer.nsecsElapsed() / 1000;
+
+		QMutexLocker locker(&m);
+		++packets;
+		bytes += packet.size();
+
+		if(packet.portOffset() != 0 || !packet.hasRtpHeader() || clockrate <= 0)
+			return;
+
+		// packets of the same video frame share a timestamp, so only
+		//   the first of each frame is timed
+		quint32 ts = packet.timestamp();
+		if(have_last && ts == last_ts)
+			return;
+
+		if(have_last)
+		{
+			qint64 expected = (qint64)(qint32)(ts - last_ts) * 1000000 / clockrate;
+			qint64 gap = now - last_arrival;
+			jitter += (qAbs((double)(gap - expected)) - jitter) / 16;
+			if(jitter > max_jitter)
+				max_jitter = jitter;
+			if(expected > 0 && gap > expected * 2)
+				++late;
+		}
+
+		have_last = true;
+		last_arrival = now;
+		last_ts = ts;
+	}
+};
+
+class Options
+{
+public:
+	QList<int> sessions;
+	int seconds;
+	int load;
+	bool loopback;
+	QString file;
+	QString audioInDeviceId;
+	PsiMedia::AudioParams audioParams;
+	PsiMedia::VideoParams videoParams;
+	bool haveVideo;
+
+	Options() :
+		seconds(10),
+		load(0),
+		loopback(false),
+		haveVideo(false)
+	{
+	}
+};
+
+// one sender, and with --loopback a receiver fed by it
+class Call : public QObject
+{
+	Q_OBJECT
+
+public:
+	PsiMedia::RtpSession producer;
+	PsiMedia::RtpSession receiver;
+	PsiMedia::RtpLoopback *audioLoop, *videoLoop;
+	PacketProbe audioProbe, videoProbe;
+	const Options &opts;
+	bool sendAudio, sendVideo;
+
+	Call(const Options &_opts, QObject *parent = 0) :
+		QObject(parent),
+		audioLoop(0),
+		videoLoop(0),
+		opts(_opts),
+		sendAudio(false),
+		sendVideo(false)
+	{
+		connect(&producer, SIGNAL(started()), SLOT(producer_started()));
+		connect(&producer, SIGNAL(error()), SLOT(session_error()));
+		connect(&receiver, SIGNAL(started()), SLOT(receiver_started()));
+		connect(&receiver, SIGNAL(error()), SLOT(session_error()));
+	}
+
+	~Call()
+	{
+		// the loopbacks and probes have to let go of the channels
+		//   before the sessions go away
+		delete audioLoop;
+		delete videoLoop;
+		if(!opts.loopback)
+		{
+			producer.audioRtpChannel()->setPacketSink(0);
+			producer.videoRtpChannel()->setPacketSink(0);
+		}
+	}
+
+	void start()
+	{
+		QList<PsiMedia::AudioParams> audioParamsList;
+		QList<PsiMedia::VideoParams> videoParamsList;
+
+		if(!opts.file.isEmpty())
+		{
+			producer.setFileInput(opts.file);
+			producer.setFileLoopEnabled(true);
+			audioParamsList += opts.audioParams;
+			if(opts.haveVideo)
+				videoParamsList += opts.videoParams;
+		}
+		else
+		{
+			producer.setAudioInputDevice(opts.audioInDeviceId);
+			audioParamsList += opts.audioParams;
+		}
+
+		producer.setLocalAudioPreferences(audioParamsList);
+		producer.setLocalVideoPreferences(videoParamsList);
+		producer.start();
+	}
+
+	int packetsForwarded() const
+	{
+		int count = 0;
+		if(audioLoop)
+			count += audioLoop->packetsForwarded();
+		if(videoLoop)
+			count += videoLoop->packetsForwarded();
+		return count;
+	}
+
+signals:
+	void ready();
+	void failed(const QString &reason);
+
+private:
+	void transmit()
+	{
+		if(sendAudio)
+			producer.transmitAudio();
+		if(sendVideo)
+			producer.transmitVideo();
+		emit ready();
+	}
+
+private slots:
+	void producer_started()
+	{
+		sendAudio = producer.canTransmitAudio() && !producer.localAudioPayloadInfo().isEmpty();
+		sendVideo = producer.canTransmitVideo() && !producer.localVideoPayloadInfo().isEmpty();
+
+		if(!opts.loopback)
+		{
+			if(sendAudio)
+			{
+				audioProbe.clockrate = producer.localAudioPayloadInfo().first().clockrate();
+				producer.audioRtpChannel()->setPacketSink(&audioProbe);
+			}
+			if(sendVideo)
+			{
+				videoProbe.clockrate = producer.localVideoPayloadInfo().first().clockrate();
+				producer.videoRtpChannel()->setPacketSink(&videoProbe);
+			}
+			transmit();
+			return;
+		}
+
+		if(sendAudio)
+		{
+			receiver.setLocalAudioPreferences(QList<PsiMedia::AudioParams>() << opts.audioParams);
+			receiver.setRemoteAudioPreferences(QList<PsiMedia::PayloadInfo>() << producer.localAudioPayloadInfo().first());
+			audioLoop = new PsiMedia::RtpLoopback(producer.audioRtpChannel(), receiver.audioRtpChannel(), this);
+		}
+		if(sendVideo)
+		{
+			receiver.setLocalVideoPreferences(QList<PsiMedia::VideoParams>() << opts.videoParams);
+			receiver.setRemoteVideoPreferences(QList<PsiMedia::PayloadInfo>() << producer.localVideoPayloadInfo().first());
+			videoLoop = new PsiMedia::RtpLoopback(producer.videoRtpChannel(), receiver.videoRtpChannel(), this);
+		}
+		receiver.start();
+	}
+
+	void receiver_started()
+	{
+		transmit();
+	}
+
+	void session_error()
+	{
+		PsiMedia::RtpSession *s = (PsiMedia::RtpSession *)sender();
+		emit failed(QString("%1 error %2").arg(s == &producer ? "sender" : "receiver").arg((int)s->errorCode()));
+	}
+};
+
+class Bench : public QObject
+{
+	Q_OBJECT
+
+public:
+	Options opts;
+	QList<Call*> calls;
+	QList<LoadThread*> loadThreads;
+	int run;
+	int callsReady;
+	QTimer startTimer;
+
+	// at the start of the measurement window
+	QElapsedTimer wall;
+	qint64 cpuStart;
+	int forwardedStart;
+	int allocatedStart, recycledStart;
+
+	Bench(const Options &_opts) :
+		opts(_opts),
+		run(-1),
+		callsReady(0),
+		cpuStart(0),
+		forwardedStart(0),
+		allocatedStart(0),
+		recycledStart(0)
+	{
+		startTimer.setSingleShot(true);
+		connect(&startTimer, SIGNAL(timeout()), SLOT(start_timeout()));
+	}
+
+	~Bench()
+	{
+		qDeleteAll(calls);
+		foreach(LoadThread *t, loadThreads)
+		{
+			t->quit = true;
+			t->wait();
+			delete t;
+		}
+	}
+
+public slots:
+	void start()
+	{
+		for(int n = 0; n < opts.load; ++n)
+		{
+			LoadThread *t = new LoadThread;
+			t->start();
+			loadThreads += t;
+		}
+
+		printf("%8s %10s %8s %8s %10s %10s %10s %10s %6s\n",
+			"sessions", "packets/s", "cpu%", "cpu%/ses",
+			"allocated", "recycled", "jitter us", "max us", "late");
+		nextRun();
+	}
+
+private:
+	void nextRun()
+	{
+		++run;
+		if(run >= opts.sessions.count())
+		{
+			QCoreApplication::exit(0);
+			return;
+		}
+
+		callsReady = 0;
+		for(int n = 0; n < opts.sessions[run]; ++n)
+		{
+			Call *call = new Call(opts);
+			connect(call, SIGNAL(ready()), SLOT(call_ready()));
+			connect(call, SIGNAL(failed(const QString &)), SLOT(call_failed(const QString &)));
+			calls += call;
+			call->start();
+		}
+
+		startTimer.start(30000);
+	}
+
+	void fail(const QString &reason)
+	{
+		fprintf(stderr, "rtpbench: %s\n", qPrintable(reason));
+		startTimer.stop();
+
+		// this may be called from within a call, so the calls are left
+		//   for the destructor
+		QCoreApplication::exit(1);
+	}
+
+private slots:
+	void call_ready()
+	{
+		++callsReady;
+		if(callsReady < calls.count())
+			return;
+
+		// let the pipelines settle before measuring
+		startTimer.stop();
+		QTimer::singleShot(2000, this, SLOT(window_start()));
+	}
+
+	void call_failed(const QString &reason)
+	{
+		fail(QString("%1 sessions: %2").arg(calls.count()).arg(reason));
+	}
+
+	void start_timeout()
+	{
+		fail(QString("%1 sessions: only %2 started").arg(calls.count()).arg(callsReady));
+	}
+
+	void window_start()
+	{
+		forwardedStart = 0;
+		foreach(Call *call, calls)
+		{
+			call->audioProbe.reset();
+			call->videoProbe.reset();
+			forwardedStart += call->packetsForwarded();
+		}
+
+		allocatedStart = PsiMedia::RtpPacket::allocatedCount();
+		recycledStart = PsiMedia::RtpPacket::recycledCount();
+		cpuStart = process_cpu_time();
+		wall.start();
+
+		QTimer::singleShot(opts.seconds * 1000, this, SLOT(window_end()));
+	}
+
+	void window_end()
+	{
+		qint64 elapsed = wall.nsecsElapsed() / 1000;
+		qint64 cpu = process_cpu_time();
+		int allocated = PsiMedia::RtpPacket::allocatedCount() - allocatedStart;
+		int recycled = PsiMedia::RtpPacket::recycledCount() - recycledStart;
+
+		int packets = 0;
+		double jitter = 0, max_jitter = 0;
+		int timed = 0, late = 0;
+		foreach(Call *call, calls)
+		{
+			if(opts.loopback)
+				packets += call->packetsForwarded();
+
+			// jitter is only kept for audio, since video frames are
+			//   not sent at a steady rate
+			PacketProbe *probes[2] = { &call->audioProbe, &call->videoProbe };
+			for(int n = 0; n < 2; ++n)
+			{
+				QMutexLocker locker(&probes[n]->m);
+				if(!opts.loopback)
+					packets += probes[n]->packets;
+				if(n == 0 && probes[n]->clockrate > 0)
+				{
+					jitter += probes[n]->jitter;
+					if(probes[n]->max_jitter > max_jitter)
+						max_jitter = probes[n]->max_jitter;
+					late += probes[n]->late;
+					++timed;
+				}
+			}
+		}
+		if(opts.loopback)
+			packets -= forwardedStart;
+		if(timed > 0)
+			jitter /= timed;
+
+		int count = calls.count();
+		double cpu_percent = -1;
+		if(cpuStart >= 0 && cpu >= 0 && elapsed > 0)
+			cpu_percent = (double)(cpu - cpuStart) * 100 / elapsed;
+
+		printf("%8d %10.0f %8.1f %8.2f %10d %10d %10.0f %10.0f %6d\n",
+			count, (double)packets * 1000000 / elapsed,
+			cpu_percent, cpu_percent >= 0 ? cpu_percent / count : -1,
+			allocated, recycled, jitter, max_jitter, late);
+		fflush(stdout);
+
+		qDeleteAll(calls);
+		calls.clear();
+
+		// give the teardown a moment before the next run
+		QTimer::singleShot(1000, this, SLOT(next_run()));
+	}
+
+	void next_run()
+	{
+		nextRun();
+	}
+};
+
+static QString findPlugin(const QString &relpath, const QString &basename)
+{
+	QDir dir(QCoreApplication::applicationDirPath());
+	if(!dir.cd(relpath))
+		return QString();
+	foreach(const QString &fileName, dir.entryList())
+	{
+		if(fileName.contains(basename))
+		{
+			QString filePath = dir.filePath(fileName);
+			if(QLibrary::isLibrary(filePath))
+				return filePath;
+		}
+	}
+	return QString();
+}
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: rtpbench (--file=FILE | --audio-in=DEVICEID) [options]\n"
+		"  --sessions=N[,N...]  concurrent sessions, one run per count (1)\n"
+		"  --seconds=N          length of each measurement (10)\n"
+		"  --loopback           feed each sender into a receiving session\n"
+		"  --load=N             busy threads to run alongside (0)\n"
+		"  --list-devices       print the audio input devices\n");
+}
+
+int main(int argc, char **argv)
+{
+	QApplication qapp(argc, argv);
+
+	QString pluginFile = qgetenv("PSI_MEDIA_PLUGIN");
+	if(pluginFile.isEmpty())
+		pluginFile = findPlugin("../../gstprovider", "gstprovider");
+	PsiMedia::loadPlugin(pluginFile, QString());
+
+	if(!PsiMedia::isSupported())
+	{
+		fprintf(stderr, "rtpbench: could not load the PsiMedia subsystem\n");
+		return 1;
+	}
+
+	Options opts;
+	bool listDevices = false;
+	QStringList args = qapp.arguments();
+	for(int n = 1; n < args.count(); ++n)
+	{
+		QString arg = args[n];
+		QString var = arg.section('=', 0, 0);
+		QString val = arg.section('=', 1);
+		bool ok = true;
+
+		if(var == "--sessions")
+		{
+			foreach(const QString &str, val.split(','))
+			{
+				int count = str.toInt(&ok);
+				if(!ok || count < 1)
+				{
+					ok = false;
+					break;
+				}
+				opts.sessions += count;
+			}
+		}
+		else if(var == "--seconds")
+		{
+			opts.seconds = val.toInt(&ok);
+			if(opts.seconds < 1)
+				ok = false;
+		}
+		else if(var == "--load")
+		{
+			opts.load = val.toInt(&ok);
+			if(opts.load < 0)
+				ok = false;
+		}
+		else if(arg == "--loopback")
+			opts.loopback = true;
+		else if(var == "--file")
+			opts.file = val;
+		else if(var == "--audio-in")
+			opts.audioInDeviceId = val;
+		else if(arg == "--list-devices")
+			listDevices = true;
+		else
+			ok = false;
+
+		if(!ok)
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	PsiMedia::Features f;
+	f.lookup(PsiMedia::Features::AudioModes | PsiMedia::Features::VideoModes | PsiMedia::Features::AudioIn);
+	f.waitForFinished();
+
+	if(listDevices)
+	{
+		foreach(const PsiMedia::Device &dev, f.audioInputDevices())
+			printf("%s\t%s\n", qPrintable(dev.id()), qPrintable(dev.name()));
+		return 0;
+	}
+
+	if(opts.file.isEmpty() == opts.audioInDeviceId.isEmpty() || f.supportedAudioModes().isEmpty())
+	{
+		usage();
+		return 1;
+	}
+
+	if(opts.sessions.isEmpty())
+		opts.sessions += 1;
+	opts.audioParams = f.supportedAudioModes().first();
+	if(!f.supportedVideoModes().isEmpty())
+	{
+		opts.videoParams = f.supportedVideoModes().first();
+		opts.haveVideo = true;
+	}
+
+	Bench bench(opts);
+	QTimer::singleShot(0, &bench, SLOT(start()));
+	return qapp.exec();
+}
+
+#include "main.moc"
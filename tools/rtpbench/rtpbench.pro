@@ -0,0 +1,14 @@
+CONFIG -= app_bundle
+CONFIG += console
+QT += network
+
+greaterThan(QT_MAJOR_VERSION, 4) {
+  QT += widgets
+}
+
+CONFIG += debug
+
+include(../../psimedia/psimedia.pri)
+INCLUDEPATH += ../../psimedia
+
+SOURCES += main.cpp